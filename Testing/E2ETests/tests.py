@@ -79,6 +79,42 @@ def test_file_decompression():
     assert os.path.getsize(path + "/alice_in_wonderland(unzp).txt") == os.path.getsize(path + "/alice_in_wonderland.txt"), f'Expected file contents to match but it does not'
     assert os.path.getsize(path + "/kjv(unzp).txt") == os.path.getsize(path + "/kjv.txt"), f'Expected file contents to match but it does not'
 
+# Function to test a file larger than 4 GiB survives compression, only run when
+# HCMP_LARGE_TESTS is set as it needs about 10 GB of disk and takes minutes
+@pytest.mark.skipif(not os.environ.get("HCMP_LARGE_TESTS"), reason="set HCMP_LARGE_TESTS to run")
+def test_large_file():
+    # Get absolute path
+    path = os.path.dirname(os.path.abspath(__file__))
+    original = path + "/large.bin"
+
+    # Create a sparse file past 4 GiB with text either side of each 32 bit boundary
+    text = b"The quick brown fox jumps over the lazy dog. " * 100
+    size = (1 << 32) + (1 << 28)
+    with open(original, "wb") as file:
+        for offset in [0, (1 << 31) - 7, (1 << 32) - 11, size - len(text)]:
+            file.seek(offset)
+            file.write(text)
+
+    try:
+        # Compress and decompress the file
+        command = f"{path}/main large.bin"
+        compression_process = subprocess.Popen(command, shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        _, compression_error = compression_process.communicate()
+        assert os.path.exists(path + "/large.hcmp"), f'Expected file to be created but it was not {compression_error}'
+        assert os.path.getsize(path + "/large.hcmp") < size
+
+        command = f"{path}/main large.hcmp"
+        decompression_process = subprocess.Popen(command, shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        _, decompression_error = decompression_process.communicate()
+        assert os.path.exists(path + "/large(unzp).bin"), f'Expected file to be created but it was not {decompression_error}'
+
+        # Confirm the contents match
+        assert subprocess.call(["cmp", "-s", original, path + "/large(unzp).bin"]) == 0, f'Expected file contents to match but it does not'
+    finally:
+        for name in ["/large.bin", "/large.hcmp", "/large(unzp).bin"]:
+            if os.path.exists(path + name):
+                os.remove(path + name)
+
 # Function to remove files produced by testing
 def test_clean_up():
     # Get absolute path
@@ -2,6 +2,7 @@
                           // in one cpp file
 #include "../../src/BitUtils.h"
 #include "catch.hpp"
+#include <sstream>
 
 // Testing functions in BitUtils.h
 TEST_CASE("Bit Manipulation: Testing BitUtils.h Functions") {
@@ -71,4 +72,98 @@ TEST_CASE("Bit Manipulation: Testing BitUtils.h Functions") {
     std::vector<unsigned char> bytes5 = {0x00};
     REQUIRE_THROWS_AS(byte_to_int(bytes5), std::invalid_argument);
   }
-}
\ No newline at end of file
+
+  SECTION("BitReader Tests:") {
+    // Testing reads from memory across the register boundary
+    std::vector<unsigned char> data;
+    for (int i = 0; i < 40; i++) {
+      data.push_back(static_cast<unsigned char>(i * 37));
+    }
+
+    BitReader reader(data.data(), data.size());
+    reader.refill();
+    REQUIRE(reader.peek(8) == data[0]);
+    REQUIRE(reader.peek(12) ==
+            static_cast<unsigned>((data[0] << 4) | (data[1] >> 4)));
+    reader.consume(4);
+    REQUIRE(reader.position() == 4u);
+    REQUIRE(reader.peek(8) ==
+            static_cast<unsigned>(((data[0] & 0x0F) << 4) | (data[1] >> 4)));
+
+    // Reading every remaining byte a nibble at a time
+    for (size_t i = 0; i < data.size() * 2 - 1; i++) {
+      reader.refill();
+      unsigned char byte = data[(i + 1) / 2];
+      unsigned int expected = (i % 2 == 0) ? (byte & 0x0F) : (byte >> 4);
+      REQUIRE(reader.peek(4) == expected);
+      reader.consume(4);
+    }
+    REQUIRE(reader.position() == data.size() * 8);
+
+    // Testing bits past the end read as zeros
+    reader.refill();
+    REQUIRE(reader.peek(BitReader::MAX_PEEK) == 0);
+
+    // Testing reads from a stream through a buffer smaller than the data
+    std::string text(1000, '\0');
+    for (size_t i = 0; i < text.size(); i++) {
+      text[i] = static_cast<char>(i * 13 + 5);
+    }
+    std::istringstream input(text);
+    BitReader streamReader(input, 16);
+    for (size_t i = 0; i < text.size(); i++) {
+      streamReader.refill();
+      REQUIRE(streamReader.peek(8) == static_cast<unsigned char>(text[i]));
+      streamReader.consume(3);
+      streamReader.consume(5);
+    }
+    REQUIRE(streamReader.position() == text.size() * 8);
+
+    // Testing seeking to a bit part way through a byte
+    reader.seek(13);
+    REQUIRE(reader.position() == 13u);
+    REQUIRE(reader.peek(8) ==
+            static_cast<unsigned>(((data[1] & 0x07) << 5) | (data[2] >> 3)));
+    reader.seek(data.size() * 8);
+    REQUIRE(reader.position() == data.size() * 8);
+    REQUIRE_THROWS_AS(reader.seek(data.size() * 8 + 1), std::invalid_argument);
+    REQUIRE_THROWS_AS(streamReader.seek(0), std::invalid_argument);
+  }
+
+  SECTION("BitWriter Tests:") {
+    // Testing codes that cross byte and register boundaries, read back with a
+    // BitReader
+    std::ostringstream output;
+    std::vector<int> lengths;
+    unsigned long long totalBits = 0;
+    {
+      BitWriter writer(output, 16);
+      for (int i = 0; i < 500; i++) {
+        int length = 1 + (i * 7) % BitWriter::MAX_WRITE;
+        writer.write((i * 0x9E3779B97F4A7C15ULL) >> (64 - length), length);
+        lengths.push_back(length);
+        totalBits += length;
+        REQUIRE(writer.position() == totalBits);
+      }
+      REQUIRE(writer.finish() == static_cast<int>((8 - totalBits % 8) % 8));
+    }
+
+    std::string written = output.str();
+    REQUIRE(written.size() == (totalBits + 7) / 8);
+    BitReader reader(reinterpret_cast<const unsigned char *>(written.data()),
+                     written.size());
+    for (int i = 0; i < 500; i++) {
+      reader.refill();
+      REQUIRE(reader.peek(lengths[i]) ==
+              (i * 0x9E3779B97F4A7C15ULL) >> (64 - lengths[i]));
+      reader.consume(lengths[i]);
+    }
+
+    // Testing the padding of a single partial byte
+    std::ostringstream shortOutput;
+    BitWriter shortWriter(shortOutput);
+    shortWriter.write(0b101, 3);
+    REQUIRE(shortWriter.finish() == 5);
+    REQUIRE(shortOutput.str() == std::string(1, '\xA0'));
+  }
+}
@@ -0,0 +1,465 @@
+#include "../../src/CompUtils.h"
+#include "catch.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+// Helper function that builds a Huffman tree for the bytes of a text
+Node *text_tree(const std::string &text) {
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(text.data());
+  Histogram occurrences = get_occurrences(data, text.size());
+  std::vector<Node *> nodes = get_occurrence_nodes(occurrences);
+  return create_huffman_tree(nodes);
+}
+
+// Helper function that builds a text with fibonacci byte counts, giving a tree
+// with one extra level per symbol, and swaps bytes around to break up the runs
+std::string fibonacci_text() {
+  std::string text;
+  int a = 1, b = 1;
+  for (char c = 'a'; c <= 'r'; c++) {
+    text += std::string(a, c);
+    int next = a + b;
+    a = b;
+    b = next;
+  }
+  for (size_t i = 0; i < text.size(); i += 7) {
+    std::swap(text[i], text[text.size() - 1 - i / 3]);
+  }
+  return text;
+}
+
+// Testing functions in CompUtils.h
+TEST_CASE("Compression: Testing CompUtils.h Functions") {
+  SECTION("encode_interleaved() Tests:") {
+    std::string longMessage = fibonacci_text();
+    Node *longTree = text_tree(longMessage);
+    EncodeTable longTable = create_encode_table(longTree);
+
+    // Testing the AVX2 packer against the scalar encoder, with bytes left
+    // over after the last whole round
+    for (int streams : {4, 8}) {
+      for (size_t size : {longMessage.size(), longMessage.size() - 3}) {
+        const unsigned char *data =
+            reinterpret_cast<const unsigned char *>(longMessage.data());
+        REQUIRE(encode_interleaved(data, size, longTable, streams, true) ==
+                encode_interleaved(data, size, longTable, streams, false));
+      }
+    }
+
+    // Testing the pair table encoders against writing one code at a time, on
+    // an odd number of bytes
+    std::string pairMessage;
+    while (pairMessage.size() < MIN_PAIR_ENCODE_SIZE) {
+      pairMessage += longMessage;
+    }
+    pairMessage += 'a';
+    const unsigned char *pairData =
+        reinterpret_cast<const unsigned char *>(pairMessage.data());
+    std::ostringstream single;
+    std::ostringstream paired;
+    {
+      BitWriter singleWriter(single);
+      encode_bytes(singleWriter, pairData, pairMessage.size(), longTable,
+                   PairTable());
+      BitWriter pairedWriter(paired);
+      encode_bytes(pairedWriter, pairData, pairMessage.size(), longTable,
+                   create_pair_table(longTable));
+    }
+    REQUIRE(paired.str() == single.str());
+    std::vector<std::vector<unsigned char>> pairPacked =
+        encode_interleaved(pairData, pairMessage.size(), longTable, 1);
+    REQUIRE(std::string(pairPacked[0].begin(), pairPacked[0].end()) ==
+            single.str());
+
+    // Testing data spanning several chunks, where every sub-stream is the
+    // single stream encoding of its own bytes
+    std::vector<std::string> strided(4);
+    for (size_t k = 0; k < pairMessage.size(); k++) {
+      strided[k % 4] += pairMessage[k];
+    }
+    REQUIRE(pairMessage.size() > ENCODE_CHUNK_ROUNDS * 4);
+    for (bool simd : {false, true}) {
+      std::vector<std::vector<unsigned char>> chunked = encode_interleaved(
+          pairData, pairMessage.size(), longTable, 4, simd);
+      for (int k = 0; k < 4; k++) {
+        REQUIRE(chunked[k] ==
+                encode_interleaved(reinterpret_cast<const unsigned char *>(
+                                       strided[k].data()),
+                                   strided[k].size(), longTable, 1)[0]);
+      }
+    }
+
+    // Testing a byte with no code throws rather than being dropped, whether
+    // it is packed with AVX2, paired or written on its own
+    std::string uncoded = "z" + pairMessage;
+    const unsigned char *uncodedData =
+        reinterpret_cast<const unsigned char *>(uncoded.data());
+    for (int streams : {1, 4, 8}) {
+      for (bool simd : {false, true}) {
+        REQUIRE_THROWS_AS(encode_interleaved(uncodedData, uncoded.size(),
+                                             longTable, streams, simd),
+                          std::runtime_error);
+      }
+    }
+    std::ostringstream dropped;
+    BitWriter droppedWriter(dropped);
+    REQUIRE_THROWS_AS(encode_bytes(droppedWriter, uncodedData, uncoded.size(),
+                                   longTable, PairTable()),
+                      std::runtime_error);
+    REQUIRE_THROWS_AS(encode_bytes(droppedWriter, uncodedData, uncoded.size(),
+                                   longTable, create_pair_table(longTable)),
+                      std::runtime_error);
+
+    delete longTree;
+  }
+
+  SECTION("encode_block_with_table() Tests:") {
+    std::string message = "it was the best of times, it was the worst of times";
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(message.data());
+    std::string longMessage = fibonacci_text();
+
+    // Testing a block long enough to pay for its own tree or canonical code
+    // lengths is Huffman coded
+    for (bool canonical : {false, true}) {
+      BlockInfo ownBlock;
+      std::vector<unsigned char> ownPayload = encode_block_with_table(
+          reinterpret_cast<const unsigned char *>(longMessage.data()),
+          longMessage.size(), ownBlock, canonical, 4);
+      REQUIRE(ownBlock.type == BLOCK_HUFFMAN);
+      REQUIRE(ownBlock.rawSize == static_cast<int>(longMessage.size()));
+      REQUIRE(ownBlock.payloadSize == static_cast<int>(ownPayload.size()));
+
+      // Testing a block too short for its code table to pay off is stored
+      BlockInfo storedBlock;
+      std::vector<unsigned char> storedPayload = encode_block_with_table(
+          data, message.size(), storedBlock, canonical, 4);
+      REQUIRE(storedBlock.type == BLOCK_STORED);
+      REQUIRE(storedBlock.payloadSize == static_cast<int>(message.size()));
+      REQUIRE(std::string(storedPayload.begin(), storedPayload.end()) ==
+              message);
+    }
+  }
+
+  SECTION("encode_blocks() Tests:") {
+    std::string message = "it was the best of times, it was the worst of times";
+    std::string longMessage = fibonacci_text();
+
+    // Testing blocks encoded on several threads come out in file order, with
+    // blocks of the short message too small to be anything but stored
+    for (int threads = 1; threads <= 4; threads++) {
+      for (const std::string &input : {message, longMessage}) {
+        size_t blockSize = input == message ? 7 : 1000;
+        std::istringstream inputFile(input);
+        std::stringstream file;
+        encode_blocks(inputFile, file, blockSize, false, 2, threads);
+
+        FileHeader header;
+        header.flags = FLAG_BLOCKS | FLAG_BLOCK_TABLES;
+        header.streams = 2;
+        std::vector<BlockInfo> blocks = read_block_table(file);
+        REQUIRE(blocks.size() == (input.size() + blockSize - 1) / blockSize);
+
+        std::string output;
+        for (const BlockInfo &block : blocks) {
+          REQUIRE(block.type == (input == message ? BLOCK_STORED
+                                                  : BLOCK_HUFFMAN));
+          std::vector<unsigned char> payload(block.payloadSize);
+          file.clear();
+          file.seekg(block.payloadOffset);
+          file.read(reinterpret_cast<char *>(payload.data()), payload.size());
+          if (block.type == BLOCK_STORED) {
+            output.append(payload.begin(), payload.end());
+            continue;
+          }
+          std::string decoded(block.rawSize, '\0');
+          decode_file_block(payload.data(), payload.size(),
+                            reinterpret_cast<unsigned char *>(&decoded[0]),
+                            decoded.size(), DecodeTable(), header);
+          output += decoded;
+        }
+        REQUIRE(output == input);
+      }
+    }
+  }
+
+  SECTION("estimate_compressed_size() Tests:") {
+    std::string message = "it was the best of times, it was the worst of times";
+    for (int i = 0; i < 6; i++) {
+      message += message;
+    }
+    {
+      std::ofstream input("estimate_test.txt", std::ios::binary);
+      input << message;
+    }
+
+    // Testing that the size is exact for layouts with one padded stream and a
+    // bound for several sub-streams
+    CompressOptions plain;
+    CompressOptions indexed;
+    indexed.indexInterval = 100;
+    CompressOptions singlePass;
+    singlePass.singlePass = true;
+    singlePass.canonical = true;
+    singlePass.blockSize = 1000;
+    CompressOptions interleaved;
+    interleaved.streams = 4;
+    for (const CompressOptions &options :
+         {plain, indexed, singlePass, interleaved}) {
+      SizeEstimate estimate =
+          estimate_compressed_size("estimate_test.txt", options);
+      compress_data("estimate_test.txt", options);
+      std::ifstream output("estimate_test.hcmp",
+                           std::ios::binary | std::ios::ate);
+      unsigned long long size = output.tellg();
+
+      REQUIRE(estimate.originalSize == message.size());
+      REQUIRE(estimate.exact == (options.streams == 1));
+      if (estimate.exact) {
+        REQUIRE(estimate.compressedSize == size);
+      } else {
+        REQUIRE(estimate.compressedSize >= size);
+        REQUIRE(estimate.compressedSize < size + options.streams);
+      }
+      REQUIRE(estimate.ratio == Approx(static_cast<double>(
+                                           estimate.compressedSize) /
+                                       message.size()));
+    }
+
+    REQUIRE_THROWS_AS(estimate_compressed_size("estimate_test.hcmp"),
+                      std::runtime_error);
+    std::remove("estimate_test.txt");
+    std::remove("estimate_test.hcmp");
+  }
+
+  SECTION("Sampled compression Tests:") {
+    // Bytes far from the start of the file, which a 1% sample of it misses
+    std::string message;
+    while (message.size() < 2 * SAMPLE_CHUNK_SIZE * 100) {
+      message += "it was the best of times, it was the worst of times. ";
+    }
+    message[message.size() / 3] = '\x01';
+    message[message.size() / 3 + 77] = '\xFF';
+    {
+      std::ofstream input("sample_test.txt", std::ios::binary);
+      input << message;
+    }
+
+    CompressOptions plain;
+    plain.samplePercent = 1;
+    CompressOptions indexed = plain;
+    indexed.indexInterval = 10000;
+    for (const CompressOptions &options : {plain, indexed}) {
+      SizeEstimate estimate =
+          estimate_compressed_size("sample_test.txt", options);
+      compress_data("sample_test.txt", options);
+      std::ifstream output("sample_test.hcmp",
+                           std::ios::binary | std::ios::ate);
+      REQUIRE(estimate.compressedSize ==
+              static_cast<unsigned long long>(output.tellg()));
+      REQUIRE(estimate.fullCompressedSize > 0);
+      REQUIRE(estimate.fullCompressedSize <= estimate.compressedSize);
+      output.close();
+
+      decompress_data("sample_test.hcmp");
+      std::ifstream restored("sample_test(unzp).txt", std::ios::binary);
+      std::string contents((std::istreambuf_iterator<char>(restored)),
+                           std::istreambuf_iterator<char>());
+      REQUIRE(contents == message);
+    }
+
+    // Testing a file whose sampled chunks are all one byte, and every other
+    // byte random, is stored once its codes turn out larger than it
+    std::string fooled(MIN_SAMPLE_CHUNKS * SAMPLE_CHUNK_SIZE, 'a');
+    size_t stride = fooled.size() / MIN_SAMPLE_CHUNKS;
+    size_t chunkStart = (stride - MIN_SAMPLE_CHUNK_SIZE) / 2;
+    unsigned int seed = 1;
+    for (size_t i = 0; i < fooled.size(); i++) {
+      seed = seed * 1103515245 + 12345;
+      if (i % stride < chunkStart ||
+          i % stride >= chunkStart + MIN_SAMPLE_CHUNK_SIZE) {
+        fooled[i] = static_cast<char>(seed >> 24);
+      }
+    }
+    {
+      std::ofstream input("fooled_test.txt", std::ios::binary);
+      input << fooled;
+    }
+    for (int streams : {1, 4}) {
+      CompressOptions options = plain;
+      options.streams = streams;
+      SizeEstimate estimate =
+          estimate_compressed_size("fooled_test.txt", options);
+      compress_data("fooled_test.txt", options);
+      std::ifstream output("fooled_test.hcmp",
+                           std::ios::binary | std::ios::ate);
+      REQUIRE(estimate.compressedSize ==
+              static_cast<unsigned long long>(output.tellg()));
+      output.seekg(0);
+      REQUIRE(read_header(output).flags == (FLAG_BLOCKS | FLAG_BLOCK_TABLES));
+      output.close();
+
+      decompress_data("fooled_test.hcmp");
+      std::ifstream restored("fooled_test(unzp).txt", std::ios::binary);
+      std::string contents((std::istreambuf_iterator<char>(restored)),
+                           std::istreambuf_iterator<char>());
+      REQUIRE(contents == fooled);
+    }
+    std::remove("fooled_test.txt");
+    std::remove("fooled_test.hcmp");
+    std::remove("fooled_test(unzp).txt");
+
+    // Testing a sample cannot be taken of a file read only once
+    CompressOptions singlePass = plain;
+    singlePass.singlePass = true;
+    REQUIRE_THROWS_AS(compress_data("sample_test.txt", singlePass),
+                      std::invalid_argument);
+
+    std::remove("sample_test.txt");
+    std::remove("sample_test.hcmp");
+    std::remove("sample_test(unzp).txt");
+  }
+
+  SECTION("get_file_occurrences() Tests:") {
+    std::string message = "it was the best of times, it was the worst of times";
+    {
+      std::ofstream input("occurrences_test.txt", std::ios::binary);
+      input << message;
+    }
+    MappedFile input("occurrences_test.txt");
+    Histogram counted = get_occurrences(input.data(), input.size());
+
+    // Testing the counts are cached the first time and read back after
+    CompressOptions cachedOptions;
+    cachedOptions.cacheDir = "occurrences_test_dir";
+    REQUIRE(get_file_occurrences("occurrences_test.txt", input,
+                                 cachedOptions) == counted);
+    HistogramKey key =
+        get_histogram_key("occurrences_test.txt", input.data(), input.size());
+
+    // Testing a cached histogram is used as it is, even one that has gone
+    // stale, and count_file_occurrences replaces it
+    Histogram planted{};
+    planted['x'] = message.size();
+    store_cached_histogram("occurrences_test_dir", key, planted);
+    REQUIRE(get_file_occurrences("occurrences_test.txt", input,
+                                 cachedOptions) == planted);
+    REQUIRE(count_file_occurrences("occurrences_test.txt", input,
+                                   cachedOptions) == counted);
+    REQUIRE(get_file_occurrences("occurrences_test.txt", input,
+                                 cachedOptions) == counted);
+
+    // Without a cache directory the file is always counted
+    REQUIRE(get_file_occurrences("occurrences_test.txt", input,
+                                 CompressOptions()) == counted);
+
+    std::remove(get_histogram_cache_path("occurrences_test_dir", key).c_str());
+    rmdir("occurrences_test_dir");
+    std::remove("occurrences_test.txt");
+  }
+
+  SECTION("Histogram cache hit Tests:") {
+    std::string message = fibonacci_text();
+    {
+      std::ofstream input("hit_test.txt", std::ios::binary);
+      input << message;
+    }
+    auto compressed = [](const CompressOptions &options) {
+      compress_data("hit_test.txt", options);
+      std::ifstream output("hit_test.hcmp", std::ios::binary);
+      return std::string((std::istreambuf_iterator<char>(output)),
+                         std::istreambuf_iterator<char>());
+    };
+
+    // Testing output from cached counts is byte for byte the output from
+    // counting the file, and so is an estimate made from them, including
+    // after an estimate has filled the cache
+    for (bool canonical : {false, true}) {
+      for (int streams : {1, 4}) {
+        CompressOptions options;
+        options.canonical = canonical;
+        options.streams = streams;
+        std::string counted = compressed(options);
+        SizeEstimate countedEstimate =
+            estimate_compressed_size("hit_test.txt", options);
+
+        options.cacheDir = "hit_test_dir";
+        SizeEstimate missEstimate =
+            estimate_compressed_size("hit_test.txt", options);
+        SizeEstimate hitEstimate =
+            estimate_compressed_size("hit_test.txt", options);
+        REQUIRE(compressed(options) == counted);
+        REQUIRE(compressed(options) == counted);
+        REQUIRE(missEstimate.compressedSize == countedEstimate.compressedSize);
+        REQUIRE(hitEstimate.compressedSize == countedEstimate.compressedSize);
+        if (hitEstimate.exact) {
+          REQUIRE(hitEstimate.compressedSize == counted.size());
+        }
+
+        MappedFile input("hit_test.txt");
+        std::remove(get_histogram_cache_path(
+                        "hit_test_dir", get_histogram_key("hit_test.txt",
+                                                          input.data(),
+                                                          input.size()))
+                        .c_str());
+      }
+    }
+
+    rmdir("hit_test_dir");
+    std::remove("hit_test.txt");
+    std::remove("hit_test.hcmp");
+  }
+
+  SECTION("Stale histogram cache Tests:") {
+    // A file whose cached counts miss bytes it holds, as when its middle is
+    // rewritten without changing its size or time
+    std::string message = fibonacci_text();
+    {
+      std::ofstream input("stale_test.txt", std::ios::binary);
+      input << message;
+    }
+    HistogramKey key;
+    {
+      MappedFile input("stale_test.txt");
+      key = get_histogram_key("stale_test.txt", input.data(), input.size());
+    }
+    Histogram planted{};
+    planted['a'] = message.size() / 2;
+    planted['b'] = message.size() - planted['a'];
+
+    // Testing the file is counted again, so it round-trips exactly in every
+    // layout and the cache holds the real counts afterwards
+    Histogram counted = get_occurrences(
+        reinterpret_cast<const unsigned char *>(message.data()), message.size());
+    for (int streams : {1, 4}) {
+      for (size_t blockSize : {size_t(0), size_t(1000)}) {
+        store_cached_histogram("stale_test_dir", key, planted);
+        CompressOptions options;
+        options.cacheDir = "stale_test_dir";
+        options.streams = streams;
+        options.blockSize = blockSize;
+        compress_data("stale_test.txt", options);
+        Histogram recounted;
+        REQUIRE(load_cached_histogram("stale_test_dir", key, recounted));
+        REQUIRE(recounted == counted);
+
+        decompress_data("stale_test.hcmp");
+        std::ifstream restored("stale_test(unzp).txt", std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(restored)),
+                             std::istreambuf_iterator<char>());
+        REQUIRE(contents == message);
+      }
+    }
+
+    std::remove(get_histogram_cache_path("stale_test_dir", key).c_str());
+    rmdir("stale_test_dir");
+    std::remove("stale_test.txt");
+    std::remove("stale_test.hcmp");
+    std::remove("stale_test(unzp).txt");
+  }
+}
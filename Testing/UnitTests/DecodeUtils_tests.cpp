@@ -0,0 +1,475 @@
+#include "../../src/CompUtils.h"
+#include "catch.hpp"
+#include <sstream>
+
+// Helper function that encodes a message with the codes from createTable,
+// packing the bits most significant first and padding the last byte with 0s.
+// The number of padding bits is stored in remainder.
+std::string encode_message(Node *head, const std::string &message,
+                           int &remainder) {
+  std::map<unsigned char, std::string> table = createTable(head);
+  std::string bits;
+  for (unsigned char c : message) {
+    bits += table[c];
+  }
+  remainder = (8 - bits.size() % 8) % 8;
+  bits += std::string(remainder, '0');
+
+  std::string bytes;
+  for (std::string::size_type i = 0; i < bits.size(); i += 8) {
+    bytes += static_cast<char>(std::stoi(bits.substr(i, 8), nullptr, 2));
+  }
+  return bytes;
+}
+
+// Helper function that builds a Huffman tree for the bytes of a message
+Node *message_tree(const std::string &message) {
+  Histogram occurrences{};
+  for (unsigned char c : message) {
+    occurrences[c]++;
+  }
+  std::vector<Node *> nodes = get_occurrence_nodes(occurrences);
+  return create_huffman_tree(nodes);
+}
+
+// Helper function that decodes an encoded message with the given decoder
+template <typename Decoder>
+std::string decode_message(Decoder decoder, Node *head,
+                           const std::string &encoded, int remainder) {
+  std::istringstream input(encoded);
+  std::ostringstream output;
+  decoder(output, input, head, remainder);
+  return output.str();
+}
+
+// Decoders with the same signature as decompress_helper
+void single_decoder(std::ostream &output, std::istream &input, Node *head,
+                    int remainder) {
+  decompress_table(output, input, head, remainder, false);
+}
+
+void multi_decoder(std::ostream &output, std::istream &input, Node *head,
+                   int remainder) {
+  decompress_table(output, input, head, remainder, true);
+}
+
+// Testing functions in DecodeUtils.h
+TEST_CASE("Table Decoding: Testing DecodeUtils.h Functions") {
+  SECTION("build_decode_table() Tests:") {
+
+    // Testing when given tree is empty
+    REQUIRE_THROWS_AS(build_decode_table(nullptr), std::invalid_argument);
+
+    // Testing a tree with codes A = 0, B = 10, C = 11
+    Node *head = new Node(0, 6);
+    head->left = new Node('A', 3);
+    head->right = new Node(0, 3);
+    head->right->left = new Node('B', 1);
+    head->right->right = new Node('C', 2);
+
+    std::vector<DecodeEntry> table = build_decode_table(head, 3).entries;
+    REQUIRE(table.size() == 8);
+
+    // Every index starting with 0 decodes to A using a single bit
+    for (int i = 0; i < 4; i++) {
+      REQUIRE(table[i].symbol == 'A');
+      REQUIRE(table[i].length == 1);
+    }
+    REQUIRE(table[4].symbol == 'B');
+    REQUIRE(table[5].symbol == 'B');
+    REQUIRE(table[5].length == 2);
+    REQUIRE(table[6].symbol == 'C');
+    REQUIRE(table[7].symbol == 'C');
+    REQUIRE(table[7].length == 2);
+
+    // Codes longer than the table point back into the tree
+    std::vector<DecodeEntry> small = build_decode_table(head, 1).entries;
+    REQUIRE(small[0].symbol == 'A');
+    REQUIRE(small[0].length == 1);
+    REQUIRE(small[1].length == 0);
+    REQUIRE(small[1].subtree == 1);
+
+    // Testing multi-symbol entries, 0 10 11 holds three whole codes and 1 0 1
+    // holds B then half of the next code
+    DecodeTable multiTable = build_decode_table(head, 5);
+    add_multi_symbol_entries(multiTable);
+    REQUIRE(multiTable.multi.size() == 32);
+    REQUIRE(multiTable.multi[0b01011].count == 3);
+    REQUIRE(multiTable.multi[0b01011].length == 5);
+    REQUIRE(multiTable.multi[0b01011].symbols[0] == 'A');
+    REQUIRE(multiTable.multi[0b01011].symbols[1] == 'B');
+    REQUIRE(multiTable.multi[0b01011].symbols[2] == 'C');
+    REQUIRE(multiTable.multi[0b10101].count == 2);
+    REQUIRE(multiTable.multi[0b10101].length == 4);
+    REQUIRE(multiTable.multi[0b00000].count == MULTI_SYMBOLS);
+
+    delete head;
+  }
+
+  SECTION("decompress_table() Tests:") {
+
+    // Testing a message of a single repeated byte
+    std::string message1(1000, 'x');
+    Node *tree1 = message_tree(message1);
+    int remainder1;
+    std::string encoded1 = encode_message(tree1, message1, remainder1);
+
+    REQUIRE(decode_message(single_decoder, tree1, encoded1, remainder1) ==
+            message1);
+
+    delete tree1;
+
+    // Testing ordinary text against the reference decoder
+    std::string message2 = "it was the best of times, it was the worst of "
+                           "times, it was the age of wisdom";
+    Node *tree2 = message_tree(message2);
+    int remainder2;
+    std::string encoded2 = encode_message(tree2, message2, remainder2);
+
+    REQUIRE(decode_message(single_decoder, tree2, encoded2, remainder2) ==
+            message2);
+    REQUIRE(decode_message(multi_decoder, tree2, encoded2, remainder2) ==
+            message2);
+    REQUIRE(decode_message(decompress_helper, tree2, encoded2, remainder2) ==
+            message2);
+
+    delete tree2;
+
+    // Testing codes longer than the table, fibonacci frequencies give a tree
+    // with one extra level per symbol
+    std::string message3;
+    int a = 1, b = 1;
+    for (char c = 'a'; c <= 'r'; c++) {
+      message3 += std::string(a, c);
+      int next = a + b;
+      a = b;
+      b = next;
+    }
+    Node *tree3 = message_tree(message3);
+    int remainder3;
+    std::string encoded3 = encode_message(tree3, message3, remainder3);
+
+    REQUIRE(decode_message(single_decoder, tree3, encoded3, remainder3) ==
+            message3);
+    REQUIRE(decode_message(multi_decoder, tree3, encoded3, remainder3) ==
+            message3);
+    REQUIRE(decode_message(decompress_helper, tree3, encoded3, remainder3) ==
+            message3);
+
+    delete tree3;
+
+    // Testing a corrupted stream, a tree with a single byte only has the
+    // code 0 so a set bit is invalid
+    Node *tree4 = message_tree(message1);
+    REQUIRE_THROWS_AS(
+        decode_message(single_decoder, tree4, std::string(1, '\x80'), 0),
+        std::runtime_error);
+
+    delete tree4;
+  }
+
+  SECTION("decompress_canonical() Tests:") {
+
+    // Testing lengths with no codes
+    REQUIRE_THROWS_AS(build_canonical_table(std::vector<unsigned char>(256, 0)),
+                      std::invalid_argument);
+
+    // Testing ordinary text, including codes longer than the table
+    std::string message = "it was the best of times, it was the worst of times";
+    int a = 1, b = 1;
+    for (char c = 'A'; c <= 'R'; c++) {
+      message += std::string(a, c);
+      int next = a + b;
+      a = b;
+      b = next;
+    }
+    Node *tree = message_tree(message);
+    std::map<unsigned char, std::string> table = createTable(tree, true);
+    std::vector<unsigned char> lengths = get_code_lengths(tree);
+
+    // Encode with the canonical codes
+    std::string bits;
+    for (unsigned char c : message) {
+      bits += table[c];
+    }
+    int remainder = (8 - bits.size() % 8) % 8;
+    bits += std::string(remainder, '0');
+    std::string encoded;
+    for (std::string::size_type i = 0; i < bits.size(); i += 8) {
+      encoded += static_cast<char>(std::stoi(bits.substr(i, 8), nullptr, 2));
+    }
+
+    std::istringstream input(encoded);
+    std::ostringstream output;
+    decompress_canonical(output, input, lengths, remainder);
+    REQUIRE(output.str() == message);
+
+    std::istringstream multiInput(encoded);
+    std::ostringstream multiOutput;
+    decompress_canonical(multiOutput, multiInput, lengths, remainder, true);
+    REQUIRE(multiOutput.str() == message);
+
+    delete tree;
+  }
+
+  SECTION("decode_interleaved() Tests:") {
+    // Testing counts too large for 4 bytes survive the header
+    FileHeader wide;
+    wide.flags = FLAG_INTERLEAVED;
+    wide.streams = 2;
+    wide.symbolCount = 5000000000LL;
+    wide.streamSizes.push_back(3000000000LL);
+    std::stringstream wideFile;
+    write_header(wideFile, wide);
+    FileHeader wideRead = read_header(wideFile);
+    REQUIRE(wideRead.version == HCMP_VERSION);
+    REQUIRE(wideRead.symbolCount == wide.symbolCount);
+    REQUIRE(wideRead.streamSizes == wide.streamSizes);
+
+    // Testing a negative sub-stream size is rejected
+    FileHeader negative = wide;
+    negative.streamSizes[0] = -1;
+    std::stringstream negativeFile;
+    write_header(negativeFile, negative);
+    REQUIRE_THROWS_AS(read_header(negativeFile), std::runtime_error);
+
+    // Testing flags that cannot be used together are rejected rather than
+    // leaving the decoder without a code table
+    for (int flags : {FLAG_BLOCK_TABLES | 0, FLAG_BLOCK_TABLES | FLAG_CANONICAL,
+                      FLAG_BLOCK_TABLES | FLAG_INTERLEAVED,
+                      FLAG_BLOCK_TABLES | FLAG_INDEX,
+                      FLAG_INDEX | FLAG_INTERLEAVED, FLAG_INDEX | FLAG_BLOCKS}) {
+      FileHeader mixed;
+      mixed.flags = flags;
+      std::stringstream mixedFile;
+      write_header(mixedFile, mixed);
+      REQUIRE_THROWS_AS(read_header(mixedFile), std::runtime_error);
+    }
+
+    std::string message = "it was the best of times, it was the worst of times";
+    Node *tree = message_tree(message);
+    EncodeTable table = create_encode_table(tree);
+    DecodeTable decodeTable = build_decode_table(tree);
+
+    // Testing every number of sub-streams, including more than there are bytes
+    // in the last round
+    for (int streams = 1; streams <= MAX_STREAMS; streams++) {
+      std::vector<std::vector<unsigned char>> packed = encode_interleaved(
+          reinterpret_cast<const unsigned char *>(message.data()),
+          message.size(), table, streams);
+      REQUIRE(packed.size() == static_cast<size_t>(streams));
+
+      FileHeader header;
+      header.streams = streams;
+      header.symbolCount = message.size();
+      std::string encoded;
+      for (int i = 0; i < streams; i++) {
+        if (i < streams - 1) {
+          header.streamSizes.push_back(packed[i].size());
+        }
+        encoded.append(packed[i].begin(), packed[i].end());
+      }
+
+      std::istringstream encodedInput(encoded);
+      std::ostringstream output;
+      OutputBuffer buffer(output);
+      decode_interleaved(buffer, encodedInput, decodeTable, header);
+      buffer.flush();
+      REQUIRE(output.str() == message);
+
+      // Testing a jump table that points past the data
+      if (streams > 1) {
+        header.streamSizes[0] = encoded.size() + 1;
+        std::istringstream badInput(encoded);
+        std::ostringstream badOutput;
+        OutputBuffer badBuffer(badOutput);
+        REQUIRE_THROWS_AS(
+            decode_interleaved(badBuffer, badInput, decodeTable, header),
+            std::runtime_error);
+      }
+    }
+
+    delete tree;
+  }
+
+  SECTION("decode_range() Tests:") {
+    std::string message = "it was the best of times, it was the worst of times";
+    Node *tree = message_tree(message);
+    std::map<unsigned char, std::string> table = createTable(tree);
+    DecodeTable decodeTable = build_decode_table(tree);
+    int remainder;
+    std::string encoded = encode_message(tree, message, remainder);
+
+    // Checkpoint every 10 bytes, written after the bitstream
+    std::vector<Checkpoint> index;
+    unsigned long long bits = 0;
+    for (size_t i = 0; i < message.size(); i++) {
+      if (i % 10 == 0) {
+        Checkpoint checkpoint;
+        checkpoint.outputOffset = i;
+        checkpoint.bitOffset = bits;
+        index.push_back(checkpoint);
+      }
+      bits += table[message[i]].size();
+    }
+    std::stringstream file;
+    file.write(encoded.data(), encoded.size());
+    write_seek_index(file, index);
+
+    file.seekg(0);
+    long long dataEnd;
+    std::vector<Checkpoint> readIndex = read_seek_index(file, dataEnd);
+    REQUIRE(dataEnd == static_cast<long long>(encoded.size()));
+    REQUIRE(readIndex.size() == index.size());
+    REQUIRE(readIndex[3].outputOffset == 30);
+    REQUIRE(readIndex[3].bitOffset == index[3].bitOffset);
+
+    // Testing ranges starting on, between and before checkpoints, and one
+    // running past the end
+    size_t ranges[][2] = {{0, 5}, {10, 10}, {13, 21}, {47, 100}, {51, 3}};
+    for (auto &range : ranges) {
+      file.clear();
+      file.seekg(0);
+      std::ostringstream output;
+      OutputBuffer buffer(output);
+      decode_range(buffer, file, decodeTable, readIndex, remainder, dataEnd,
+                   range[0], range[1]);
+      buffer.flush();
+      REQUIRE(output.str() == message.substr(range[0], range[1]));
+    }
+
+    // Testing an index that claims more checkpoints than fit in the file
+    std::stringstream badFile;
+    write_offset(badFile, 1000);
+    REQUIRE_THROWS_AS(read_seek_index(badFile, dataEnd), std::runtime_error);
+
+    delete tree;
+  }
+
+  SECTION("decode_block() Tests:") {
+    std::string message = "it was the best of times, it was the worst of times";
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(message.data());
+    Node *tree = message_tree(message);
+    EncodeTable table = create_encode_table(tree);
+    DecodeTable decodeTable = build_decode_table(tree);
+
+    for (int streams = 1; streams <= MAX_STREAMS; streams++) {
+      std::vector<unsigned char> payload =
+          encode_block(data, message.size(), table, streams);
+
+      std::string output(message.size(), '\0');
+      decode_block(payload.data(), payload.size(),
+                   reinterpret_cast<unsigned char *>(&output[0]),
+                   output.size(), decodeTable, streams);
+      REQUIRE(output == message);
+
+      // Testing a block that is missing its last byte
+      REQUIRE_THROWS_AS(
+          decode_block(payload.data(), payload.size() - 1,
+                       reinterpret_cast<unsigned char *>(&output[0]),
+                       output.size(), decodeTable, streams),
+          std::runtime_error);
+    }
+
+    // Testing a block long enough for the AVX2 decoder, including codes
+    // longer than the table, against the scalar decoder
+    std::string longMessage;
+    int a = 1, b = 1;
+    for (char c = 'a'; c <= 'r'; c++) {
+      longMessage += std::string(a, c);
+      int next = a + b;
+      a = b;
+      b = next;
+    }
+    for (size_t i = 0; i < longMessage.size(); i += 7) {
+      std::swap(longMessage[i], longMessage[longMessage.size() - 1 - i / 3]);
+    }
+    Node *longTree = message_tree(longMessage);
+    EncodeTable longTable = create_encode_table(longTree);
+    DecodeTable simdTable = build_decode_table(longTree);
+    DecodeTable scalarTable = simdTable;
+    scalarTable.simd = false;
+
+    std::vector<unsigned char> longPayload = encode_block(
+        reinterpret_cast<const unsigned char *>(longMessage.data()),
+        longMessage.size(), longTable, 8);
+    for (DecodeTable *decoder : {&simdTable, &scalarTable}) {
+      std::string output(longMessage.size(), '\0');
+      decode_block(longPayload.data(), longPayload.size(),
+                   reinterpret_cast<unsigned char *>(&output[0]),
+                   output.size(), *decoder, 8);
+      REQUIRE(output == longMessage);
+    }
+
+    delete longTree;
+
+    // Testing blocks that carry their own tree or canonical code lengths
+    for (bool canonical : {false, true}) {
+      FileHeader header;
+      header.flags = FLAG_BLOCKS | FLAG_BLOCK_TABLES;
+      if (canonical) {
+        header.flags |= FLAG_CANONICAL;
+      }
+      header.streams = 4;
+      DecodeTable settings;
+
+      BlockInfo ownBlock;
+      std::vector<unsigned char> ownPayload = encode_block_with_table(
+          reinterpret_cast<const unsigned char *>(longMessage.data()),
+          longMessage.size(), ownBlock, canonical, 4);
+      std::string output(longMessage.size(), '\0');
+      decode_file_block(ownPayload.data(), ownPayload.size(),
+                        reinterpret_cast<unsigned char *>(&output[0]),
+                        output.size(), settings, header);
+      REQUIRE(output == longMessage);
+
+      // Testing a code table size that runs past the payload
+      ownPayload[0] = 0x7F;
+      REQUIRE_THROWS_AS(
+          decode_file_block(ownPayload.data(), ownPayload.size(),
+                            reinterpret_cast<unsigned char *>(&output[0]),
+                            output.size(), settings, header),
+          std::runtime_error);
+    }
+
+    // Testing the block table of three blocks with different sizes
+    std::stringstream file;
+    size_t offsets[] = {0, 20, 40, message.size()};
+    for (int i = 0; i < 3; i++) {
+      std::vector<unsigned char> payload = encode_block(
+          data + offsets[i], offsets[i + 1] - offsets[i], table, 2);
+      BlockInfo block;
+      block.rawSize = offsets[i + 1] - offsets[i];
+      block.payloadSize = payload.size();
+      write_block_header(file, block);
+      file.write(reinterpret_cast<const char *>(payload.data()),
+                 payload.size());
+    }
+
+    std::vector<BlockInfo> blocks = read_block_table(file);
+    REQUIRE(blocks.size() == 3);
+    REQUIRE(blocks[0].payloadOffset == BLOCK_HEADER_SIZE);
+    REQUIRE(blocks[1].outputOffset == 20);
+    REQUIRE(blocks[2].outputOffset == 40);
+    REQUIRE(blocks[2].rawSize == static_cast<int>(message.size()) - 40);
+
+    // Testing a block table that runs past the end of the file
+    std::string truncated = file.str();
+    truncated.pop_back();
+    std::istringstream truncatedFile(truncated);
+    REQUIRE_THROWS_AS(read_block_table(truncatedFile), std::runtime_error);
+
+    // Testing a stored block whose payload is not its raw size
+    std::stringstream storedFile;
+    BlockInfo stored;
+    stored.type = BLOCK_STORED;
+    stored.rawSize = 4;
+    stored.payloadSize = 3;
+    write_block_header(storedFile, stored);
+    storedFile << "abc";
+    REQUIRE_THROWS_AS(read_block_table(storedFile), std::runtime_error);
+
+    delete tree;
+  }
+}
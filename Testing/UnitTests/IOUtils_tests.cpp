@@ -0,0 +1,133 @@
+#include "../../src/IOUtils.h"
+#include "catch.hpp"
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+// Helper function that fills an output buffer using every way of adding bytes
+// and returns the bytes that were expected to be written
+std::string fill_output(OutputBuffer &output) {
+  std::string expected;
+
+  for (int i = 0; i < 5000; i++) {
+    output.put(static_cast<unsigned char>(i));
+    expected += static_cast<char>(i);
+  }
+
+  // A write that fits in the buffer and one that does not
+  std::string small(100, 's');
+  output.write(reinterpret_cast<const unsigned char *>(small.data()),
+               small.size());
+  expected += small;
+  std::string large(3 * MIN_OUTPUT_BUFFER, 'L');
+  output.write(reinterpret_cast<const unsigned char *>(large.data()),
+               large.size());
+  expected += large;
+
+  unsigned char *space = output.claim(10);
+  for (int i = 0; i < 10; i++) {
+    space[i] = static_cast<unsigned char>('0' + i);
+  }
+  expected += "0123456789";
+
+  output.flush();
+  return expected;
+}
+
+// Testing functions in IOUtils.h
+TEST_CASE("Buffered Output: Testing IOUtils.h Functions") {
+  SECTION("OutputBuffer Stream Tests:") {
+    // Testing a buffer smaller than the minimum is enlarged
+    std::ostringstream stream;
+    OutputBuffer output(stream, 1);
+    REQUIRE(output.capacity() == MIN_OUTPUT_BUFFER);
+
+    std::string expected = fill_output(output);
+    REQUIRE(stream.str() == expected);
+  }
+
+  SECTION("OutputBuffer File Descriptor Tests:") {
+    std::FILE *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    int fd = fileno(file);
+
+    std::string expected;
+    {
+      OutputBuffer output(fd, MIN_OUTPUT_BUFFER);
+      expected = fill_output(output);
+    }
+
+    // Read back what was written through writev
+    std::string written(expected.size() + 1, '\0');
+    REQUIRE(lseek(fd, 0, SEEK_SET) == 0);
+    ssize_t count = read(fd, &written[0], written.size());
+    REQUIRE(count == static_cast<ssize_t>(expected.size()));
+    written.resize(count);
+    REQUIRE(written == expected);
+
+    std::fclose(file);
+  }
+
+  SECTION("copy_at() Tests:") {
+    std::FILE *input = std::tmpfile();
+    std::FILE *output = std::tmpfile();
+    REQUIRE(input != nullptr);
+    REQUIRE(output != nullptr);
+
+    std::string data(3 * MIN_OUTPUT_BUFFER, 'x');
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = static_cast<char>(i * 7);
+    }
+    write_at(fileno(input), reinterpret_cast<const unsigned char *>(data.data()),
+             data.size(), 0);
+
+    // Copy the middle of the input to an offset past the end of the output
+    copy_at(fileno(input), 100, fileno(output), 10, 5000);
+    std::string copied(5000, '\0');
+    read_at(fileno(output), reinterpret_cast<unsigned char *>(&copied[0]),
+            copied.size(), 10);
+    REQUIRE(copied == data.substr(100, 5000));
+
+    // Testing a copy that runs past the end of the input
+    REQUIRE_THROWS_AS(
+        copy_at(fileno(input), data.size() - 10, fileno(output), 0, 20),
+        std::runtime_error);
+
+    std::fclose(input);
+    std::fclose(output);
+  }
+
+  SECTION("MappedFile Tests:") {
+    std::string data(3 * MIN_OUTPUT_BUFFER + 5, 'x');
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = static_cast<char>(i * 13);
+    }
+    std::FILE *file = std::fopen("mapped_test.bin", "wb");
+    REQUIRE(file != nullptr);
+    std::fwrite(data.data(), 1, data.size(), file);
+    std::fclose(file);
+
+    // Testing both with and without reading the pages in up front
+    for (bool populate : {false, true}) {
+      MappedFile mapped("mapped_test.bin", populate);
+      REQUIRE(mapped.mapped());
+      REQUIRE(mapped.size() == data.size());
+      REQUIRE(std::string(reinterpret_cast<const char *>(mapped.data()),
+                          mapped.size()) == data);
+    }
+
+    // Testing an empty file, which cannot be mapped
+    file = std::fopen("mapped_test.bin", "wb");
+    REQUIRE(file != nullptr);
+    std::fclose(file);
+    MappedFile empty("mapped_test.bin");
+    REQUIRE(!empty.mapped());
+    REQUIRE(empty.size() == 0);
+    REQUIRE(empty.data() == nullptr);
+    std::remove("mapped_test.bin");
+
+    // Testing a file that does not exist
+    REQUIRE_THROWS_AS(MappedFile("mapped_test.bin"), std::runtime_error);
+  }
+}
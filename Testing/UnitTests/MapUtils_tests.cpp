@@ -0,0 +1,187 @@
+#include "../../src/MapUtils.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Testing functions in MapUtils.h
+TEST_CASE("Byte Counting: Testing MapUtils.h Functions") {
+  SECTION("count_bytes() Tests:") {
+    // An odd length so some bytes are left over after the words of eight,
+    // and a long run of one byte
+    std::vector<unsigned char> data;
+    for (int i = 0; i < 10001; i++) {
+      data.push_back(static_cast<unsigned char>(i * i + i / 7));
+    }
+    data.insert(data.end(), 999, 'z');
+
+    Histogram expected{};
+    for (unsigned char byte : data) {
+      expected[byte]++;
+    }
+    Histogram counts{};
+    count_bytes(data.data(), data.size(), counts);
+    REQUIRE(counts == expected);
+    Histogram whole = counts;
+
+    // Counts are added to whatever the table already holds
+    count_bytes(data.data() + 3, 5, counts);
+    for (int i = 3; i < 8; i++) {
+      expected[data[i]]++;
+    }
+    REQUIRE(counts == expected);
+
+    Histogram occurrences = get_occurrences(data.data(), data.size());
+    REQUIRE(occurrences == whole);
+    REQUIRE(get_occurrences(data.data(), 0) == Histogram{});
+
+    // Only bytes that appear get a node, in order of byte value
+    std::vector<Node *> nodes = get_occurrence_nodes(occurrences);
+    size_t appearing = 0;
+    for (int value = 0; value < 256; value++) {
+      if (occurrences[value] > 0) {
+        REQUIRE(nodes[appearing]->value == value);
+        REQUIRE(nodes[appearing]->frequency == occurrences[value]);
+        appearing++;
+      }
+    }
+    REQUIRE(nodes.size() == appearing);
+    for (Node *node : nodes) {
+      delete node;
+    }
+
+    // Testing the counts come out the same when split over several threads,
+    // including one per hardware thread
+    std::vector<unsigned char> large(3 * MIN_THREAD_COUNT_SIZE + 5);
+    for (size_t i = 0; i < large.size(); i++) {
+      large[i] = static_cast<unsigned char>(i % 251 + i / 100000);
+    }
+    Histogram serial = get_occurrences(large.data(), large.size());
+    for (int threads : {0, 2, 3, 8}) {
+      REQUIRE(get_occurrences(large.data(), large.size(), threads) == serial);
+    }
+
+    // Testing a sample counts evenly spaced chunks and gives every byte value
+    // a count, even ones the chunks miss
+    Histogram sampled = get_sampled_occurrences(large.data(), large.size(), 10);
+    unsigned long long sampledTotal = 0;
+    for (unsigned long long count : sampled) {
+      REQUIRE(count >= 1);
+      sampledTotal += count;
+    }
+    size_t chunks = (large.size() / 10 + SAMPLE_CHUNK_SIZE - 1) /
+                    SAMPLE_CHUNK_SIZE;
+    REQUIRE(sampledTotal >= chunks * SAMPLE_CHUNK_SIZE);
+    REQUIRE(sampledTotal <= chunks * SAMPLE_CHUNK_SIZE + 256);
+
+    // Testing a small sample is still spread over MIN_SAMPLE_CHUNKS chunks
+    // from the middle of their strides, reaching the end of the data but
+    // skipping its first and last bytes
+    std::vector<unsigned char> spread(large.size(), 'a');
+    size_t stride = spread.size() / MIN_SAMPLE_CHUNKS;
+    std::fill(spread.begin(), spread.begin() + 100, 'f');
+    std::fill(spread.end() - 100, spread.end(), 'l');
+    std::fill_n(spread.begin() + stride * (MIN_SAMPLE_CHUNKS - 1) + stride / 2,
+                100, 'z');
+    Histogram small = get_sampled_occurrences(spread.data(), spread.size(), 0.1);
+    REQUIRE(small['z'] == 100);
+    REQUIRE(small['f'] == 1);
+    REQUIRE(small['l'] == 1);
+    REQUIRE(small['a'] == MIN_SAMPLE_CHUNKS * MIN_SAMPLE_CHUNK_SIZE - 100);
+
+    // A sample that would cover everything counts everything
+    REQUIRE(get_sampled_occurrences(large.data(), large.size(), 100) ==
+            serial);
+    REQUIRE(get_sampled_occurrences(data.data(), data.size(), 1) ==
+            occurrences);
+  }
+
+  SECTION("get_scaled_coded_bits() Tests:") {
+    std::vector<Node *> nodeVector{new Node('A', 3), new Node('B', 1)};
+    Node *huffmanTree = create_huffman_tree(nodeVector);
+    EncodeTable table = create_encode_table(huffmanTree);
+
+    // Counts of the whole data give the exact length, counts of a quarter of
+    // it four times as much
+    Histogram occurrences{};
+    occurrences['A'] = 3;
+    occurrences['B'] = 1;
+    REQUIRE(get_scaled_coded_bits(occurrences, table, 4) == 4);
+    REQUIRE(get_scaled_coded_bits(occurrences, table, 16) == 16);
+
+    delete huffmanTree;
+  }
+
+  SECTION("Histogram cache Tests:") {
+    std::string data(3 * CACHE_HASH_SIZE, 'c');
+    data[10] = 'a';
+    data[data.size() - 10] = 'b';
+    {
+      std::ofstream file("cache_test.txt", std::ios::binary);
+      file << data;
+    }
+    const unsigned char *bytes =
+        reinterpret_cast<const unsigned char *>(data.data());
+    HistogramKey key = get_histogram_key("cache_test.txt", bytes, data.size());
+    REQUIRE(key.size == data.size());
+    Histogram occurrences = get_occurrences(bytes, data.size());
+
+    // Testing a stored histogram comes back for the same key
+    Histogram loaded{};
+    REQUIRE(!load_cached_histogram("cache_test_dir", key, loaded));
+    store_cached_histogram("cache_test_dir", key, occurrences);
+    REQUIRE(load_cached_histogram("cache_test_dir", key, loaded));
+    REQUIRE(loaded == occurrences);
+
+    // Testing a change at either end of the file, or to its size or time,
+    // makes the histogram invalid
+    std::string changed = data;
+    changed[data.size() - 10] = 'd';
+    const unsigned char *changedBytes =
+        reinterpret_cast<const unsigned char *>(changed.data());
+    HistogramKey changedKey =
+        get_histogram_key("cache_test.txt", changedBytes, changed.size());
+    REQUIRE(changedKey.contentHash != key.contentHash);
+    REQUIRE(!load_cached_histogram("cache_test_dir", changedKey, loaded));
+    changedKey = key;
+    changedKey.size++;
+    REQUIRE(!load_cached_histogram("cache_test_dir", changedKey, loaded));
+    changedKey = key;
+    changedKey.modifiedNanoseconds++;
+    REQUIRE(!load_cached_histogram("cache_test_dir", changedKey, loaded));
+
+    // Testing a change between the hashed blocks at either end is not seen by
+    // the key, so the stale histogram still loads. compress_data counts the
+    // file again when such a histogram misses a byte of it.
+    std::string middle = data;
+    middle[data.size() / 2] = 'z';
+    HistogramKey middleKey = get_histogram_key(
+        "cache_test.txt", reinterpret_cast<const unsigned char *>(middle.data()),
+        middle.size());
+    REQUIRE(middleKey.contentHash == key.contentHash);
+    REQUIRE(load_cached_histogram("cache_test_dir", middleKey, loaded));
+    REQUIRE(loaded['z'] == 0);
+
+    // Testing a truncated cache file is not used
+    std::string path = get_histogram_cache_path("cache_test_dir", key);
+    {
+      std::ifstream cacheFile(path, std::ios::binary);
+      std::string contents((std::istreambuf_iterator<char>(cacheFile)),
+                           std::istreambuf_iterator<char>());
+      std::ofstream truncated(path, std::ios::binary);
+      truncated << contents.substr(0, contents.size() - 8);
+    }
+    REQUIRE(!load_cached_histogram("cache_test_dir", key, loaded));
+
+    REQUIRE_THROWS_AS(get_histogram_key("cache_missing.txt", bytes, 1),
+                      std::runtime_error);
+
+    std::remove(path.c_str());
+    rmdir("cache_test_dir");
+    std::remove("cache_test.txt");
+  }
+}
@@ -1,3 +1,4 @@
+#include "../../src/MapUtils.h"
 #include "../../src/TreeUtils.h"
 #include "catch.hpp"
 
@@ -216,6 +217,39 @@ TEST_CASE("Tree Manipulation: Testing TreeUtils.h Functions") {
     delete response5;
   }
 
+  SECTION("flat_tree_from_packet() Tests:") {
+
+    // Testing empty and invalidly sized packets
+    REQUIRE_THROWS_AS(flat_tree_from_packet({}), std::invalid_argument);
+    REQUIRE_THROWS_AS(flat_tree_from_packet({'A'}), std::invalid_argument);
+
+    // Testing a tree that is a lone leaf
+    REQUIRE_THROWS_AS(flat_tree_from_packet({'A', 0x00, 0x00, 0x00, 0x02, 'A'}),
+                      std::invalid_argument);
+
+    // Testing a packet that ends in the middle of the tree
+    REQUIRE_THROWS_AS(flat_tree_from_packet({'A', 0x00, 0x00, 0x00, 0x02, 'D'}),
+                      std::invalid_argument);
+
+    // Testing a packet with an unknown flag
+    REQUIRE_THROWS_AS(flat_tree_from_packet({'A', 0x00, 0x00, 0x00, 0x02, 'Q'}),
+                      std::invalid_argument);
+
+    // Testing the random valid packet from the tree_reconstructor() tests
+    std::vector<unsigned char> nodePacket = {
+        'A',  0x00, 0x00, 0x00, 0x02, 'D',  'B',  0x00, 0x00, 0x00,
+        0x03, 'A',  'C',  0x00, 0x00, 0x00, 0x04, 'C',  'D',  0x00,
+        0x00, 0x00, 0x05, 'B',  'E',  0x00, 0x00, 0x00, 0x06, 'A',
+    };
+
+    // Internal nodes A, C and D become nodes 0, 1 and 2
+    FlatTree tree = flat_tree_from_packet(nodePacket);
+    REQUIRE(tree.children ==
+            std::vector<unsigned short>{
+                static_cast<unsigned short>(FLAT_LEAF | 'B'), 1, 2, FLAT_EMPTY,
+                FLAT_EMPTY, static_cast<unsigned short>(FLAT_LEAF | 'E')});
+  }
+
   SECTION("create_huffman_tree() Tests:") {
     // Create an empty vector for testing
     std::vector<Node *> nodeVector1;
@@ -234,6 +268,18 @@ TEST_CASE("Tree Manipulation: Testing TreeUtils.h Functions") {
 
     delete huffmanTree2;
 
+    // Test two nodes, which become the children of the root
+    std::vector<Node *> nodeVectorPair{new Node('A', 12), new Node('B', 3)};
+
+    Node *huffmanTreePair = create_huffman_tree(nodeVectorPair);
+
+    REQUIRE(get_huffman_values(huffmanTreePair) ==
+            std::vector<unsigned char>{'B', 'A'});
+    REQUIRE(get_huffman_frequencies(huffmanTreePair) ==
+            std::vector<int>{15, 3, 12});
+
+    delete huffmanTreePair;
+
     // Create a second random valid vector for testing
     std::vector<Node *> nodeVector3{new Node('A', 12), new Node('B', 3),
                                     new Node('C', 22), new Node('D', 10)};
@@ -262,5 +308,171 @@ TEST_CASE("Tree Manipulation: Testing TreeUtils.h Functions") {
         std::vector<int>{123, 56, 27, 12, 15, 29, 67, 30, 37, 15, 5, 10, 22});
 
     delete huffmanTree4;
+
+    // Testing frequencies too large for 32 bits, which the tree packet stores
+    // as the largest int
+    std::vector<Node *> nodeVectorLarge{new Node('A', 5000000000ULL),
+                                        new Node('B', 3000000000ULL),
+                                        new Node('C', 1)};
+
+    Node *huffmanTreeLarge = create_huffman_tree(nodeVectorLarge);
+
+    REQUIRE(huffmanTreeLarge->frequency == 8000000001ULL);
+    REQUIRE(get_huffman_values(huffmanTreeLarge) ==
+            std::vector<unsigned char>{'C', 'B', 'A'});
+    std::vector<unsigned char> largePacket = get_tree_packet(huffmanTreeLarge);
+    REQUIRE(std::vector<unsigned char>(largePacket.begin() + 1,
+                                       largePacket.begin() + 5) ==
+            std::vector<unsigned char>{0x7F, 0xFF, 0xFF, 0xFF});
+
+    Histogram largeOccurrences{};
+    largeOccurrences['A'] = 5000000000ULL;
+    largeOccurrences['B'] = 3000000000ULL;
+    largeOccurrences['C'] = 1;
+    EncodeTable largeTable = create_encode_table(huffmanTreeLarge);
+    REQUIRE(get_coded_bits(largeOccurrences, largeTable) == 11000000002ULL);
+
+    delete huffmanTreeLarge;
+  }
+
+  SECTION("get_canonical_codes() Tests:") {
+    // Testing code lengths of the wrong size
+    REQUIRE_THROWS_AS(get_canonical_codes(std::vector<unsigned char>(4, 1)),
+                      std::invalid_argument);
+
+    // Testing lengths that cannot form a prefix code, three codes of length 1
+    std::vector<unsigned char> lengths1(256, 0);
+    lengths1['A'] = 1;
+    lengths1['B'] = 1;
+    lengths1['C'] = 1;
+    REQUIRE_THROWS_AS(get_canonical_codes(lengths1), std::invalid_argument);
+
+    // Testing valid lengths, codes are ordered by length then value
+    std::vector<unsigned char> lengths2(256, 0);
+    lengths2['D'] = 2;
+    lengths2['A'] = 3;
+    lengths2['B'] = 1;
+    lengths2['C'] = 3;
+    std::vector<unsigned long long> codes2 = get_canonical_codes(lengths2);
+    REQUIRE(codes2['B'] == 0b0);
+    REQUIRE(codes2['D'] == 0b10);
+    REQUIRE(codes2['A'] == 0b110);
+    REQUIRE(codes2['C'] == 0b111);
+  }
+
+  SECTION("createTable() Canonical Tests:") {
+    std::vector<Node *> nodeVector{new Node('A', 12), new Node('B', 5),
+                                   new Node('C', 22), new Node('D', 10),
+                                   new Node('E', 15), new Node('F', 30),
+                                   new Node('G', 29)};
+
+    Node *huffmanTree = create_huffman_tree(nodeVector);
+
+    std::map<unsigned char, std::string> treeTable = createTable(huffmanTree);
+    std::map<unsigned char, std::string> canonicalTable =
+        createTable(huffmanTree, true);
+
+    // Canonical codes keep the lengths of the tree codes
+    REQUIRE(canonicalTable.size() == treeTable.size());
+    for (auto &entry : treeTable) {
+      REQUIRE(canonicalTable[entry.first].size() == entry.second.size());
+    }
+
+    // Shortest codes come first, ties broken by byte value
+    REQUIRE(canonicalTable['F'] == "00");
+    REQUIRE(canonicalTable['G'] == "01");
+    REQUIRE(canonicalTable['A'] == "100");
+    REQUIRE(canonicalTable['C'] == "101");
+    REQUIRE(canonicalTable['E'] == "110");
+    REQUIRE(canonicalTable['B'] == "1110");
+    REQUIRE(canonicalTable['D'] == "1111");
+
+    delete huffmanTree;
+  }
+
+  SECTION("create_encode_table() Tests:") {
+    REQUIRE_THROWS_AS(create_encode_table(nullptr), std::invalid_argument);
+
+    std::vector<Node *> nodeVector{new Node('A', 12), new Node('B', 5),
+                                   new Node('C', 22), new Node('D', 10),
+                                   new Node('E', 15), new Node('F', 30),
+                                   new Node('G', 29)};
+
+    Node *huffmanTree = create_huffman_tree(nodeVector);
+
+    // Every code matches the path createTable gives, tree and canonical
+    for (bool canonical : {false, true}) {
+      std::map<unsigned char, std::string> stringTable =
+          createTable(huffmanTree, canonical);
+      EncodeTable table = create_encode_table(huffmanTree, canonical);
+
+      for (int value = 0; value < 256; value++) {
+        auto found = stringTable.find(static_cast<unsigned char>(value));
+        if (found == stringTable.end()) {
+          REQUIRE(table[value].length == 0);
+          continue;
+        }
+        REQUIRE(table[value].length ==
+                static_cast<int>(found->second.size()));
+        REQUIRE(table[value].code == std::stoull(found->second, nullptr, 2));
+      }
+    }
+
+    // Testing the padding for an A (3 bits) and a B (4 bits), 7 bits in all,
+    // then adding F's (2 bits each)
+    EncodeTable table = create_encode_table(huffmanTree, true);
+    Histogram occurrences{};
+    occurrences['A'] = 1;
+    occurrences['B'] = 1;
+    REQUIRE(get_coded_bits(occurrences, table) == 7);
+    REQUIRE(get_padding_amount(occurrences, table) == 1);
+    occurrences['F'] = 1;
+    REQUIRE(get_padding_amount(occurrences, table) == 7);
+    occurrences['F'] = 4;
+    REQUIRE(get_padding_amount(occurrences, table) == 1);
+
+    delete huffmanTree;
+  }
+
+  SECTION("create_pair_table() Tests:") {
+    std::vector<Node *> nodeVector{new Node('A', 12), new Node('B', 5),
+                                   new Node('C', 22)};
+    Node *huffmanTree = create_huffman_tree(nodeVector);
+    EncodeTable table = create_encode_table(huffmanTree);
+    PairTable pairs = create_pair_table(table);
+    REQUIRE(pairs.size() == 65536);
+
+    // Every entry is the first code followed by the second
+    for (unsigned char first : {'A', 'B', 'C'}) {
+      for (unsigned char second : {'A', 'B', 'C'}) {
+        unsigned long long entry = pairs[first << 8 | second];
+        int length = table[first].length + table[second].length;
+        REQUIRE(static_cast<int>(entry >> 56) == length);
+        REQUIRE((entry & ((1ULL << 56) - 1)) ==
+                (table[first].code << table[second].length |
+                 table[second].code));
+      }
+    }
+
+    // Testing a tree with a code longer than MAX_CODE_LENGTH, more than a
+    // BitWriter can write at once, is rejected when the table is built
+    Node *deepTree = new Node('a', 1);
+    for (int depth = 0; depth <= MAX_CODE_LENGTH; depth++) {
+      Node *parent = new Node();
+      parent->left = deepTree;
+      parent->right = new Node(static_cast<char>('b' + depth % 20), 1);
+      deepTree = parent;
+    }
+    for (bool canonical : {false, true}) {
+      REQUIRE_THROWS_AS(create_encode_table(deepTree, canonical),
+                        std::runtime_error);
+    }
+    delete deepTree;
+
+    // Testing a code too long to be paired
+    table['A'].length = MAX_PAIR_CODE_LENGTH + 1;
+    REQUIRE(create_pair_table(table).empty());
+
+    delete huffmanTree;
   }
-}
\ No newline at end of file
+}
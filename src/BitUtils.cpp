@@ -43,4 +43,134 @@ int byte_to_int(std::vector<unsigned char> bytes) {
               (static_cast<int>(bytes[1]) << 16) |
               (static_cast<int>(bytes[2]) << 8) | static_cast<int>(bytes[3]);
   return value;
-}
\ No newline at end of file
+}
+
+/**
+ * Creates a bit reader over a block of memory.
+ *
+ * @param data The bytes to read bits from.
+ * @param size The number of bytes of data.
+ */
+BitReader::BitReader(const unsigned char *data, size_t size)
+    : start(data), next(data), end(data + size) {}
+
+/**
+ * Creates a bit reader that reads from a stream through a buffer.
+ *
+ * @param input The stream to read bits from, starting at its current position.
+ * @param bufferSize The number of bytes to read from the stream at a time.
+ */
+BitReader::BitReader(std::istream &input, size_t bufferSize)
+    : input(&input), storage(bufferSize < 16 ? 16 : bufferSize) {
+  start = next = end = storage.data();
+}
+
+/**
+ * Refills the register when fewer than 8 bytes are buffered.
+ *
+ * When reading from a stream, the unread bytes are moved to the front of the
+ * buffer and the rest of it is filled from the stream before trying the fast
+ * refill again. At the real end of the data the remaining bytes are added one
+ * at a time, after which the register is left with zeros past the end.
+ */
+void BitReader::refill_slow() {
+  if (input != nullptr && *input) {
+    size_t left = end - next;
+    offset += next - start;
+    std::memmove(storage.data(), next, left);
+    input->read(reinterpret_cast<char *>(storage.data() + left),
+                storage.size() - left);
+    start = next = storage.data();
+    end = storage.data() + left + input->gcount();
+
+    if (end - next >= 8) {
+      refill();
+      return;
+    }
+  }
+
+  while (count <= 56 && next < end) {
+    bits |= static_cast<unsigned long long>(*next++) << (56 - count);
+    count += 8;
+  }
+}
+
+/**
+ * Moves a reader made from a block of memory to a given bit of its data.
+ *
+ * The register is emptied and refilled from the byte holding the bit, then
+ * the bits of that byte before it are dropped.
+ *
+ * @param bitPosition The number of bits from the start of the data.
+ * @throws std::invalid_argument If the reader reads from a stream or the
+ * position is past the end of the data.
+ */
+void BitReader::seek(unsigned long long bitPosition) {
+  if (input != nullptr) {
+    throw std::invalid_argument("Only readers of memory can seek.");
+  }
+  if (bitPosition > static_cast<unsigned long long>(end - start) * 8) {
+    throw std::invalid_argument("Seek position is past the end of the data.");
+  }
+
+  next = start + bitPosition / 8;
+  bits = 0;
+  count = 0;
+  refill();
+  consume(bitPosition % 8);
+}
+
+/**
+ * Creates a bit writer that writes to a stream through a buffer.
+ *
+ * @param output The stream to write bits to, starting at its current position.
+ * @param bufferSize The number of bytes to collect before writing them.
+ */
+BitWriter::BitWriter(std::ostream &output, size_t bufferSize)
+    : output(&output), buffer(bufferSize < 16 ? 16 : bufferSize) {}
+
+/**
+ * Writes out whatever finish was not called for, ignoring errors as a
+ * destructor cannot report them.
+ */
+BitWriter::~BitWriter() {
+  try {
+    finish();
+  } catch (...) {
+  }
+}
+
+/**
+ * Writes the buffered bytes to the stream.
+ *
+ * @throws std::runtime_error If the stream cannot be written.
+ */
+void BitWriter::flush() {
+  if (used > 0) {
+    if (!output->write(reinterpret_cast<const char *>(buffer.data()), used)) {
+      throw std::runtime_error("Failed to write the output file.");
+    }
+    written += used;
+    used = 0;
+  }
+}
+
+/**
+ * Writes every remaining bit, padding the last byte with zeros.
+ *
+ * Further codes can still be written afterwards, they start on the next byte.
+ *
+ * @return The number of padding bits added to the last byte.
+ * @throws std::runtime_error If the stream cannot be written.
+ */
+int BitWriter::finish() {
+  drain();
+  int padding = 0;
+  if (count > 0) {
+    padding = 8 - count;
+    count = 8;
+    drain();
+  }
+  flush();
+  return padding;
+}
@@ -2,6 +2,10 @@
 #define BIT_UTILS_H
 
 #include <bitset>
+#include <cassert>
+#include <cstring>
+#include <istream>
+#include <ostream>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -9,4 +13,142 @@
 std::vector<unsigned char> int_to_bytes(int num);
 int byte_to_int(std::vector<unsigned char> bytes);
 
-#endif
\ No newline at end of file
+// Loads 8 bytes as a big-endian 64 bit integer
+inline unsigned long long load_big_endian_64(const unsigned char *bytes) {
+  unsigned long long value;
+  std::memcpy(&value, bytes, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+// Stores a 64 bit integer as 8 big-endian bytes
+inline void store_big_endian_64(unsigned char *bytes,
+                                unsigned long long value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  std::memcpy(bytes, &value, sizeof(value));
+}
+
+// Reads a bitstream most significant bit first through a 64 bit register.
+// The unread bits sit at the top of the register, so peeking is a single
+// shift and consuming shifts them out. Bits past the end of the data read as
+// zeros. The reader works either on a block of memory or on a stream, which is
+// read through a large buffer.
+class BitReader {
+public:
+  // Largest number of bits that can be peeked after a refill
+  static const int MAX_PEEK = 56;
+
+  BitReader(const unsigned char *data, size_t size);
+  BitReader(std::istream &input, size_t bufferSize = 1 << 20);
+
+  // Tops the register up to at least MAX_PEEK bits. While 8 bytes of data are
+  // buffered this is one unaligned load with no data dependent branches.
+  void refill() {
+    if (end - next >= 8) {
+      bits |= load_big_endian_64(next) >> count;
+      next += (63 - count) >> 3;
+      count |= 56;
+    } else {
+      refill_slow();
+    }
+  }
+
+  // Returns the next amount bits (1 to MAX_PEEK) without consuming them
+  unsigned long long peek(int amount) const { return bits >> (64 - amount); }
+
+  // Drops the next amount bits, which must have been refilled
+  void consume(int amount) {
+    bits <<= amount;
+    count -= amount;
+  }
+
+  // Number of bits consumed since the start of the data
+  unsigned long long position() const {
+    return (offset + (next - start)) * 8 - count;
+  }
+
+  // The data of a reader made from a block of memory
+  const unsigned char *data() const { return start; }
+  size_t size() const { return end - start; }
+
+  void seek(unsigned long long bitPosition);
+
+private:
+  void refill_slow();
+
+  std::istream *input = nullptr;
+  std::vector<unsigned char> storage;
+  const unsigned char *start = nullptr;
+  const unsigned char *next = nullptr;
+  const unsigned char *end = nullptr;
+
+  // Offset in the data of the byte at start
+  unsigned long long offset = 0;
+
+  unsigned long long bits = 0;
+  int count = 0;
+};
+
+// Writes a bitstream most significant bit first through a 64 bit register.
+// Codes are ORed in below the bits already waiting, and whole bytes are moved
+// out with one big-endian store into a large buffer, which is written to the
+// stream when full. finish pads the last byte with zeros.
+class BitWriter {
+public:
+  // Longest code that can be written at once
+  static const int MAX_WRITE = 56;
+
+  explicit BitWriter(std::ostream &output, size_t bufferSize = 1 << 20);
+  ~BitWriter();
+
+  BitWriter(const BitWriter &) = delete;
+  BitWriter &operator=(const BitWriter &) = delete;
+
+  // Adds the low length bits (1 to MAX_WRITE) of code. The code tables are
+  // checked for lengths past MAX_WRITE when built and the encoders reject a
+  // length of 0, so this is only asserted here
+  void write(unsigned long long code, int length) {
+    assert(length >= 1 && length <= MAX_WRITE);
+    if (count + length > 64) {
+      drain();
+    }
+    bits |= code << (64 - count - length);
+    count += length;
+  }
+
+  // Number of bits written since the writer was created
+  unsigned long long position() const {
+    return (written + used) * 8 + count;
+  }
+
+  int finish();
+
+private:
+  // Moves the whole bytes of the register into the buffer
+  void drain() {
+    store_big_endian_64(buffer.data() + used, bits);
+    int bytes = count >> 3;
+    used += bytes;
+    bits = bytes == 8 ? 0 : bits << (bytes * 8);
+    count &= 7;
+    if (used > buffer.size() - 8) {
+      flush();
+    }
+  }
+
+  void flush();
+
+  std::ostream *output;
+  std::vector<unsigned char> buffer;
+  size_t used = 0;
+  unsigned long long written = 0;
+
+  unsigned long long bits = 0;
+  int count = 0;
+};
+
+#endif
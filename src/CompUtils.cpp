@@ -1,16 +1,23 @@
 #include "CompUtils.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 /**
- * This function decompresses a file that was compressed using Huffman coding.
+ * Reference decoder that walks the Huffman tree one bit at a time.
  *
  * It reads the input file one byte at a time, converting each byte into a
  * string of 1s and 0s (bits). It then uses this bit string to traverse the
  * Huffman tree. When it reaches a leaf node (a node with no children), it
  * writes the value of that node to the output file.
  *
- * If it reaches the end of the file, it removes the remainder bits from the bit
- * string. The process is repeated until there are no more bytes left in the
- * input file.
+ * When it reads the last byte of the file, it removes the remainder bits from
+ * the bit string. The process is repeated until there are no more bytes left
+ * in the input file.
+ *
+ * This is far slower than decompress_table and is only kept as a simple,
+ * obviously correct decoder to test the faster decoders against.
  *
  * @param outputFile The file where the decompressed data will be written.
  * @param inputFile The compressed file to be decompressed.
@@ -18,7 +25,7 @@
  * @param remainder The number of remainder bits in the last byte of the input
  * file.
  */
-void decompress_helper(std::ofstream &outputFile, std::ifstream &inputFile,
+void decompress_helper(std::ostream &outputFile, std::istream &inputFile,
                        Node *head, int remainder) {
   Node *current = head;
   unsigned char byte;
@@ -29,13 +36,13 @@ void decompress_helper(std::ofstream &outputFile, std::ifstream &inputFile,
     bits += std::bitset<8>(byte)
                 .to_string(); // Convert the byte to a string of 8 bits
 
-    if (inputFile.eof()) {
+    if (inputFile.peek() == std::char_traits<char>::eof()) {
       // Delete the remainder bits
       bits = bits.substr(0, bits.size() - remainder);
-      byteSize = bits.size() - remainder;
+      byteSize = bits.size();
     }
 
-    while (bits.size() >= byteSize) {
+    while (!bits.empty() && bits.size() >= byteSize) {
       for (char bit : bits) {
         if (bit == '0') {
           current = current->left;
@@ -46,6 +53,10 @@ void decompress_helper(std::ofstream &outputFile, std::ifstream &inputFile,
               "Invalid bit encountered in decompression.");
         }
 
+        if (current == nullptr) {
+          throw std::runtime_error("Invalid code encountered in decompression.");
+        }
+
         if (current->left == nullptr && current->right == nullptr) {
           unsigned char value = current->value;
           outputFile.write(reinterpret_cast<const char *>(&value),
@@ -58,13 +69,1269 @@ void decompress_helper(std::ofstream &outputFile, std::ifstream &inputFile,
   }
 }
 
+/**
+ * Decodes a Huffman bitstream using a lookup table.
+ *
+ * Instead of following one tree pointer per bit, this function reads the input
+ * through a BitReader and peeks table.tableBits bits at a time. Each peek
+ * indexes the decode table, which gives the decoded byte and how many bits its
+ * code used, so a whole symbol is resolved per lookup. Codes longer than the
+ * table are finished by decode_long_code.
+ *
+ * If the table has multi-symbol entries, each peek first tries those, writing
+ * every byte whose code fits in the peeked bits at once, and only falls back
+ * to the single symbol entry when the next code does not fit.
+ *
+ * The size of the remaining input is measured up front so the padding bits in
+ * the final byte (given by remainder) are never decoded.
+ *
+ * @param output The buffer the decompressed data is written to.
+ * @param inputFile The compressed file, positioned at the start of the
+ * bitstream.
+ * @param table The decode table for the codes the bitstream was written with.
+ * @param remainder The number of remainder bits in the last byte of the
+ * bitstream.
+ * @param end The offset in the file where the bitstream ends, or -1 if it runs
+ * to the end of the file.
+ * @throws std::runtime_error If the bitstream contains an invalid code.
+ */
+void decode_bitstream(OutputBuffer &output, std::istream &inputFile,
+                      const DecodeTable &table, int remainder, long long end) {
+  const int tableBits = table.tableBits;
+  const bool multiSymbol = !table.multi.empty();
+
+  // Find how many bits of actual data follow the header
+  std::streampos start = inputFile.tellg();
+  if (end < 0) {
+    inputFile.seekg(0, std::ios::end);
+    end = inputFile.tellg();
+    inputFile.seekg(start);
+  }
+  unsigned long long totalBits =
+      static_cast<unsigned long long>(end - start) * 8 - remainder;
+
+  BitReader reader(inputFile);
+
+  while (reader.position() < totalBits) {
+    reader.refill();
+    unsigned long long remainingBits = totalBits - reader.position();
+    unsigned int index = reader.peek(tableBits);
+
+    if (multiSymbol) {
+      const MultiEntry &multi = table.multi[index];
+      if (multi.count > 0 && multi.length <= remainingBits) {
+        output.write(multi.symbols, multi.count);
+        reader.consume(multi.length);
+        continue;
+      }
+    }
+
+    const DecodeEntry &entry = table.entries[index];
+    unsigned char value = entry.symbol;
+    int length = entry.length;
+
+    if (length == 0 &&
+        !decode_long_code(table, entry, reader.peek(BitReader::MAX_PEEK),
+                          BitReader::MAX_PEEK, value, length)) {
+      throw std::runtime_error("Invalid code encountered in decompression.");
+    }
+
+    if (static_cast<unsigned long long>(length) > remainingBits) {
+      throw std::runtime_error("Truncated code encountered in decompression.");
+    }
+
+    output.put(value);
+    reader.consume(length);
+  }
+}
+
+/**
+ * Decodes a Huffman bitstream using a lookup table built from the tree.
+ *
+ * @param outputFile The file where the decompressed data will be written.
+ * @param inputFile The compressed file, positioned at the start of the
+ * bitstream.
+ * @param head The root of the Huffman tree used for decompression.
+ * @param remainder The number of remainder bits in the last byte of the input
+ * file.
+ * @param multiSymbol Whether to decode several bytes per lookup when their
+ * codes fit.
+ */
+void decompress_table(std::ostream &outputFile, std::istream &inputFile,
+                      Node *head, int remainder, bool multiSymbol) {
+  DecodeTable table = build_decode_table(
+      head, multiSymbol ? MULTI_TABLE_BITS : DECODE_TABLE_BITS);
+  if (multiSymbol) {
+    add_multi_symbol_entries(table);
+  }
+  OutputBuffer output(outputFile);
+  decode_bitstream(output, inputFile, table, remainder);
+  output.flush();
+}
+
+/**
+ * Decodes a bitstream of canonical Huffman codes using a lookup table.
+ *
+ * This works like decompress_table but needs only the code lengths of each
+ * byte rather than a tree, as the table is built with build_canonical_table.
+ *
+ * @param outputFile The file where the decompressed data will be written.
+ * @param inputFile The compressed file, positioned at the start of the
+ * bitstream.
+ * @param lengths The 256 code lengths the file was compressed with.
+ * @param remainder The number of remainder bits in the last byte of the input
+ * file.
+ * @param multiSymbol Whether to decode several bytes per lookup when their
+ * codes fit.
+ */
+void decompress_canonical(std::ostream &outputFile, std::istream &inputFile,
+                          const std::vector<unsigned char> &lengths,
+                          int remainder, bool multiSymbol) {
+  DecodeTable table = build_canonical_table(
+      lengths, multiSymbol ? MULTI_TABLE_BITS : DECODE_TABLE_BITS);
+  if (multiSymbol) {
+    add_multi_symbol_entries(table);
+  }
+  OutputBuffer output(outputFile);
+  decode_bitstream(output, inputFile, table, remainder);
+  output.flush();
+}
+
+/**
+ * Decodes the next byte of one interleaved sub-stream.
+ *
+ * The sub-stream's reader is refilled, then the next table.tableBits bits are
+ * looked up in the decode table. Past the end of the sub-stream the reader
+ * returns zeros, so running out of bits is only checked once all bytes have
+ * been decoded.
+ *
+ * @param stream The reader of the sub-stream to decode from.
+ * @param table The decode table for the codes the sub-stream was written with.
+ * @return The decoded byte.
+ * @throws std::runtime_error If the sub-stream contains an invalid code.
+ */
+unsigned char decode_symbol(BitReader &stream, const DecodeTable &table) {
+  stream.refill();
+  const DecodeEntry &entry = table.entries[stream.peek(table.tableBits)];
+  unsigned char value = entry.symbol;
+  int length = entry.length;
+
+  if (length == 0 &&
+      !decode_long_code(table, entry, stream.peek(BitReader::MAX_PEEK),
+                        BitReader::MAX_PEEK, value, length)) {
+    throw std::runtime_error("Invalid code encountered in decompression.");
+  }
+
+  stream.consume(length);
+  return value;
+}
+
+/**
+ * Decodes whole rounds of interleaved sub-streams into a buffer.
+ *
+ * Byte i of the buffer is decoded from sub-stream i % streams.size(), so
+ * every round decodes one byte from each sub-stream in turn. The count does not
+ * need to be a whole number of rounds, the last round then stops part way.
+ *
+ * Eight sub-streams are decoded with decode_rounds_avx2 when the CPU supports
+ * it, which leaves any rounds it cannot do to the scalar loop.
+ *
+ * @param streams The readers of the sub-streams, positioned at the start of a
+ * round.
+ * @param output Where the decoded bytes are stored.
+ * @param count The number of bytes to decode.
+ * @param table The decode table for the codes the sub-streams were written
+ * with.
+ * @throws std::runtime_error If a sub-stream contains an invalid code.
+ */
+void decode_rounds(std::vector<BitReader> &streams, unsigned char *output,
+                   size_t count, const DecodeTable &table) {
+  const size_t streamCount = streams.size();
+  size_t i = decode_rounds_avx2(streams, output, count, table);
+  size_t fullRounds = count - count % streamCount;
+
+  while (i < fullRounds) {
+    for (size_t k = 0; k < streamCount; k++) {
+      output[i + k] = decode_symbol(streams[k], table);
+    }
+    i += streamCount;
+  }
+  for (size_t k = 0; i < count; k++) {
+    output[i++] = decode_symbol(streams[k], table);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Decodes rounds of eight interleaved sub-streams with AVX2.
+ *
+ * The bit positions of all eight sub-streams sit in one YMM register. Every
+ * round gathers the 4 bytes holding each sub-stream's next bits, shifts away
+ * the bits already used and gathers the eight packed decode table entries the
+ * next tableBits bits of each sub-stream index. The entries give the eight
+ * decoded bytes and how far each position moves on, so a whole round is done
+ * without a branch per sub-stream.
+ *
+ * Rounds are only decoded while every 4 byte load stays inside its
+ * sub-stream, and a round holding a code longer than the table is decoded one
+ * sub-stream at a time with decode_symbol. Once the readers are moved to where
+ * the kernel stopped, the scalar loop in decode_rounds finishes the rest.
+ *
+ * @param streams The readers of the sub-streams, which must read from memory.
+ * @param output Where the decoded bytes are stored.
+ * @param count The number of bytes left to decode.
+ * @param table The decode table for the codes the sub-streams were written
+ * with.
+ * @return The number of bytes decoded, a whole number of rounds. This is 0
+ * when there are not eight sub-streams, the table has SIMD turned off or no
+ * packed entries, or the CPU has no AVX2.
+ * @throws std::runtime_error If a sub-stream contains an invalid code.
+ */
+__attribute__((target("avx2"))) size_t
+decode_rounds_avx2(std::vector<BitReader> &streams, unsigned char *output,
+                   size_t count, const DecodeTable &table) {
+  const int lanes = 8;
+  if (streams.size() != lanes || !table.simd || table.packed.empty() ||
+      !__builtin_cpu_supports("avx2")) {
+    return 0;
+  }
+
+  // Every lane gathers from one base pointer with a 32 bit offset, so the
+  // sub-streams must all lie within 2 GB of the lowest one
+  const unsigned char *base = streams[0].data();
+  for (BitReader &stream : streams) {
+    base = std::min(base, stream.data());
+  }
+
+  int offsets[lanes];
+  int limits[lanes];
+  int positions[lanes];
+  for (int k = 0; k < lanes; k++) {
+    long long offset = streams[k].data() - base;
+    long long size = streams[k].size();
+    if (offset + size > 0x7FFFFFFF || size * 8 > 0x7FFFFFFF) {
+      return 0;
+    }
+    offsets[k] = offset;
+    positions[k] = streams[k].position();
+
+    // Last position whose 4 byte load stays inside the sub-stream
+    limits[k] = (size - 4) * 8;
+  }
+
+  const __m256i byteSwap = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5,
+      4, 11, 10, 9, 8, 15, 14, 13, 12);
+  const __m256i lowBytes = _mm256_setr_epi8(
+      0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i joinHalves = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+  const __m256i seven = _mm256_set1_epi32(7);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m128i indexShift = _mm_cvtsi32_si128(32 - table.tableBits);
+  const int *entries = reinterpret_cast<const int *>(table.packed.data());
+  const __m256i offsetVector =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(offsets));
+
+  size_t rounds = count / lanes;
+  size_t done = 0;
+
+  while (done < rounds) {
+    // Each round moves a position on by at most tableBits, find how many
+    // rounds can run before a load could leave its sub-stream
+    size_t safe = rounds - done;
+    for (int k = 0; k < lanes; k++) {
+      if (positions[k] > limits[k]) {
+        safe = 0;
+        break;
+      }
+      safe = std::min<size_t>(
+          safe, (limits[k] - positions[k]) / table.tableBits + 1);
+    }
+    if (safe == 0) {
+      break;
+    }
+
+    __m256i position =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(positions));
+    size_t end = done + safe;
+
+    while (done < end) {
+      __m256i byteIndex =
+          _mm256_add_epi32(offsetVector, _mm256_srli_epi32(position, 3));
+      __m256i words = _mm256_i32gather_epi32(
+          reinterpret_cast<const int *>(base), byteIndex, 1);
+      words = _mm256_shuffle_epi8(words, byteSwap);
+      __m256i window =
+          _mm256_sllv_epi32(words, _mm256_and_si256(position, seven));
+      __m256i index = _mm256_srl_epi32(window, indexShift);
+      __m256i entry = _mm256_i32gather_epi32(entries, index, 4);
+      __m256i length = _mm256_srli_epi32(entry, 8);
+
+      if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(length, zero)) != 0) {
+        // A code is longer than the table, decode this round one sub-stream
+        // at a time and work out the safe rounds again
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(positions), position);
+        for (int k = 0; k < lanes; k++) {
+          streams[k].seek(positions[k]);
+          output[done * lanes + k] = decode_symbol(streams[k], table);
+          if (streams[k].position() > streams[k].size() * 8) {
+            throw std::runtime_error(
+                "Truncated code encountered in decompression.");
+          }
+          positions[k] = streams[k].position();
+        }
+        position =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(positions));
+        done++;
+        break;
+      }
+
+      position = _mm256_add_epi32(position, length);
+      __m256i symbols = _mm256_permutevar8x32_epi32(
+          _mm256_shuffle_epi8(entry, lowBytes), joinHalves);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(output + done * lanes),
+                       _mm256_castsi256_si128(symbols));
+      done++;
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(positions), position);
+  }
+
+  for (int k = 0; k < lanes; k++) {
+    streams[k].seek(positions[k]);
+  }
+  return done * lanes;
+}
+#else
+/**
+ * Stands in for the AVX2 decoder on CPUs without it.
+ *
+ * @return 0, leaving every round to the scalar loop in decode_rounds.
+ */
+size_t decode_rounds_avx2(std::vector<BitReader> &streams,
+                          unsigned char *output, size_t count,
+                          const DecodeTable &table) {
+  return 0;
+}
+#endif
+
+/**
+ * Decodes data that was split round-robin over several sub-streams.
+ *
+ * Byte i of the original file was encoded into sub-stream i % streams, and
+ * each sub-stream is bit-packed on its own. The whole compressed data is read
+ * into memory, split using the jump table of sub-stream sizes and then every
+ * round of the loop decodes one byte from each sub-stream in turn. As the
+ * sub-streams do not depend on each other, the CPU can work on the lookups of
+ * all of them at the same time rather than waiting for each code's length
+ * before starting on the next.
+ *
+ * @param output The buffer the decompressed data is written to.
+ * @param inputFile The compressed file, positioned at the start of the first
+ * sub-stream.
+ * @param table The decode table for the codes the data was written with.
+ * @param header The header of the file, holding the number of sub-streams,
+ * their sizes and the number of bytes to decode.
+ * @throws std::runtime_error If the jump table does not match the data or a
+ * sub-stream contains an invalid code.
+ */
+void decode_interleaved(OutputBuffer &output, std::istream &inputFile,
+                        const DecodeTable &table, const FileHeader &header) {
+  std::vector<unsigned char> data(
+      std::istreambuf_iterator<char>(inputFile), {});
+
+  // Use the jump table to find where every sub-stream starts
+  std::vector<BitReader> streams;
+  std::vector<size_t> sizes;
+  size_t offset = 0;
+  for (int i = 0; i < header.streams; i++) {
+    size_t size = data.size() - offset;
+    if (i < header.streams - 1) {
+      size = header.streamSizes[i];
+    }
+    if (size > data.size() - offset) {
+      throw std::runtime_error("Sub-stream sizes exceed the compressed data.");
+    }
+    streams.emplace_back(data.data() + offset, size);
+    sizes.push_back(size);
+    offset += size;
+  }
+
+  // Decode straight into the output buffer, a whole number of rounds at a time
+  size_t chunk = output.capacity() - output.capacity() % header.streams;
+  long long remaining = header.symbolCount;
+
+  while (remaining > 0) {
+    size_t count = chunk;
+    if (remaining < static_cast<long long>(count)) {
+      count = remaining;
+    }
+    decode_rounds(streams, output.claim(count), count, table);
+    remaining -= count;
+  }
+
+  // A sub-stream that ran out of bits was decoded from the zero padding
+  for (int i = 0; i < header.streams; i++) {
+    if (streams[i].position() > sizes[i] * 8) {
+      throw std::runtime_error("Truncated code encountered in decompression.");
+    }
+  }
+}
+
+/**
+ * Decodes one block of a file split into blocks.
+ *
+ * A block's payload starts with a jump table of the sizes of every sub-stream
+ * but the last, followed by the sub-streams themselves. With a single stream
+ * the payload is just the bitstream. The number of bytes to decode comes from
+ * the block header, so the padding at the end of each sub-stream is never
+ * decoded.
+ *
+ * @param payload The payload of the block.
+ * @param payloadSize The number of bytes in the payload.
+ * @param output Where the decoded bytes are stored, rawSize bytes long.
+ * @param rawSize The number of bytes the block decodes to.
+ * @param table The decode table for the codes the block was written with.
+ * @param streams The number of sub-streams the block was split over.
+ * @throws std::runtime_error If the jump table does not match the payload or
+ * a sub-stream contains an invalid code.
+ */
+void decode_block(const unsigned char *payload, size_t payloadSize,
+                  unsigned char *output, size_t rawSize,
+                  const DecodeTable &table, int streams) {
+  size_t jumpTableSize = 4 * static_cast<size_t>(streams - 1);
+  if (payloadSize < jumpTableSize) {
+    throw std::runtime_error("Block is too small for its jump table.");
+  }
+
+  std::vector<BitReader> readers;
+  std::vector<size_t> sizes;
+  size_t offset = jumpTableSize;
+  for (int i = 0; i < streams; i++) {
+    size_t size = payloadSize - offset;
+    if (i < streams - 1) {
+      std::vector<unsigned char> bytes(payload + 4 * i, payload + 4 * i + 4);
+      size = static_cast<unsigned int>(byte_to_int(bytes));
+    }
+    if (size > payloadSize - offset) {
+      throw std::runtime_error("Sub-stream sizes exceed the block.");
+    }
+    readers.emplace_back(payload + offset, size);
+    sizes.push_back(size);
+    offset += size;
+  }
+
+  decode_rounds(readers, output, rawSize, table);
+
+  // A sub-stream that ran out of bits was decoded from the zero padding
+  for (int i = 0; i < streams; i++) {
+    if (readers[i].position() > sizes[i] * 8) {
+      throw std::runtime_error("Truncated code encountered in decompression.");
+    }
+  }
+}
+
+/**
+ * Decodes one block of a file split into blocks, whatever its code table.
+ *
+ * When the file has FLAG_BLOCK_TABLES, the payload starts with the size of the
+ * block's own code table and the table itself, which is turned into a decode
+ * table with the same settings as the file's before decoding the rest of the
+ * payload with decode_block. Otherwise the block uses the file's table.
+ *
+ * @param payload The payload of the block.
+ * @param payloadSize The number of bytes in the payload.
+ * @param output Where the decoded bytes are stored, rawSize bytes long.
+ * @param rawSize The number of bytes the block decodes to.
+ * @param table The decode table of the file, or with FLAG_BLOCK_TABLES an
+ * empty table holding only the settings to build each block's table with.
+ * @param header The header of the file.
+ * @throws std::runtime_error If the block is invalid.
+ * @throws std::invalid_argument If the block's code table is invalid.
+ */
+void decode_file_block(const unsigned char *payload, size_t payloadSize,
+                       unsigned char *output, size_t rawSize,
+                       const DecodeTable &table, const FileHeader &header) {
+  if (!(header.flags & FLAG_BLOCK_TABLES)) {
+    decode_block(payload, payloadSize, output, rawSize, table, header.streams);
+    return;
+  }
+
+  if (payloadSize < 4) {
+    throw std::runtime_error("Block is too small for its code table.");
+  }
+  std::vector<unsigned char> bytes(payload, payload + 4);
+  size_t tableSize = static_cast<unsigned int>(byte_to_int(bytes));
+  if (tableSize > payloadSize - 4) {
+    throw std::runtime_error("Block is too small for its code table.");
+  }
+
+  std::vector<unsigned char> codeTable(payload + 4, payload + 4 + tableSize);
+  DecodeTable blockTable = build_code_table(
+      codeTable, header.flags & FLAG_CANONICAL, table.tableBits);
+  blockTable.simd = table.simd;
+  decode_block(payload + 4 + tableSize, payloadSize - 4 - tableSize, output,
+               rawSize, blockTable, header.streams);
+}
+
+/**
+ * Decodes the blocks of a file on several threads.
+ *
+ * Every block is coded on its own and read_block_table gives both where its
+ * payload is and where its bytes go in the output, so the blocks can be
+ * decoded in any order. Each thread repeatedly takes the next block nobody has
+ * started yet, reads its payload with read_at, decodes it into a buffer of its
+ * own and writes the bytes straight to their final place in the output file
+ * with write_at. Stored blocks are copied from the input to the output with
+ * copy_at without being read into memory. The calling thread works on blocks
+ * as well, so with a single thread the blocks are simply decoded in order.
+ *
+ * The first error any thread hits stops the others from starting new blocks
+ * and is rethrown once every thread has finished.
+ *
+ * @param inputFd The hcmp file to read the payloads from.
+ * @param outputFd The file to write the decoded bytes to.
+ * @param blocks The blocks of the file, as returned by read_block_table.
+ * @param table The decode table for the codes the blocks were written with,
+ * as passed to decode_file_block.
+ * @param header The header of the file.
+ * @param threads The number of threads to decode with, 0 for one per hardware
+ * thread.
+ * @throws std::runtime_error If a file cannot be read or written or a block is
+ * invalid.
+ */
+void decode_blocks(int inputFd, int outputFd,
+                   const std::vector<BlockInfo> &blocks,
+                   const DecodeTable &table, const FileHeader &header,
+                   int threads) {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (static_cast<size_t>(threads) > blocks.size()) {
+    threads = std::max<size_t>(1, blocks.size());
+  }
+
+  // Size the output up front so the blocks can be written in any order
+  long long total = 0;
+  for (const BlockInfo &block : blocks) {
+    total += block.rawSize;
+  }
+  if (ftruncate(outputFd, total) != 0) {
+    throw std::runtime_error("Failed to write the output file.");
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+
+  auto worker = [&]() {
+    std::vector<unsigned char> payload;
+    std::vector<unsigned char> decoded;
+    try {
+      for (size_t i = next++; i < blocks.size() && !failed; i = next++) {
+        const BlockInfo &block = blocks[i];
+        if (block.type == BLOCK_STORED) {
+          copy_at(inputFd, block.payloadOffset, outputFd, block.outputOffset,
+                  block.rawSize);
+          continue;
+        }
+        payload.resize(block.payloadSize);
+        decoded.resize(block.rawSize);
+        read_at(inputFd, payload.data(), payload.size(), block.payloadOffset);
+        decode_file_block(payload.data(), payload.size(), decoded.data(),
+                          decoded.size(), table, header);
+        write_at(outputFd, decoded.data(), decoded.size(), block.outputOffset);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      failed = true;
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int i = 1; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/**
+ * Decodes a range of bytes from a single bitstream.
+ *
+ * Decoding starts at the last checkpoint of the seek index at or before the
+ * first byte of the range rather than at the start of the bitstream. The bytes
+ * between the checkpoint and the range are decoded and dropped, and decoding
+ * stops as soon as the last byte of the range is written. A range running past
+ * the end of the file is cut short.
+ *
+ * @param output The buffer the bytes of the range are written to.
+ * @param inputFile The compressed file, positioned at the start of the
+ * bitstream.
+ * @param table The decode table for the codes the bitstream was written with.
+ * @param index The checkpoints of the seek index, may be empty.
+ * @param remainder The number of remainder bits in the last byte of the
+ * bitstream.
+ * @param end The offset in the file where the bitstream ends, or -1 if it runs
+ * to the end of the file.
+ * @param first The offset in the original file of the first byte to decode.
+ * @param length The number of bytes to decode.
+ * @throws std::runtime_error If the bitstream contains an invalid code.
+ */
+void decode_range(OutputBuffer &output, std::istream &inputFile,
+                  const DecodeTable &table,
+                  const std::vector<Checkpoint> &index, int remainder,
+                  long long end, unsigned long long first,
+                  unsigned long long length) {
+  Checkpoint checkpoint;
+  for (const Checkpoint &candidate : index) {
+    if (candidate.outputOffset > first) {
+      break;
+    }
+    checkpoint = candidate;
+  }
+
+  std::streampos start = inputFile.tellg();
+  if (end < 0) {
+    inputFile.seekg(0, std::ios::end);
+    end = inputFile.tellg();
+  }
+
+  // Start reading from the byte holding the checkpoint's first bit
+  unsigned long long startByte = checkpoint.bitOffset / 8;
+  unsigned long long totalBits =
+      static_cast<unsigned long long>(end - start) * 8 - remainder;
+  unsigned long long limit = totalBits - startByte * 8;
+  inputFile.seekg(start + static_cast<std::streamoff>(startByte));
+
+  BitReader reader(inputFile);
+  reader.refill();
+  reader.consume(checkpoint.bitOffset % 8);
+
+  unsigned long long skip = first - checkpoint.outputOffset;
+  while (length > 0 && reader.position() < limit) {
+    unsigned char value = decode_symbol(reader, table);
+    if (reader.position() > limit) {
+      throw std::runtime_error("Truncated code encountered in decompression.");
+    }
+
+    if (skip > 0) {
+      skip--;
+    } else {
+      output.put(value);
+      length--;
+    }
+  }
+}
+
+/**
+ * Decodes a range of bytes from a file split into blocks.
+ *
+ * Only the blocks holding part of the range are read and decoded, and only
+ * the bytes of the range are written. Of a stored block only the bytes in the
+ * range are read.
+ *
+ * @param output The buffer the bytes of the range are written to.
+ * @param inputFile The hcmp file.
+ * @param blocks The blocks of the file, as returned by read_block_table.
+ * @param table The decode table for the codes the blocks were written with,
+ * as passed to decode_file_block.
+ * @param header The header of the file.
+ * @param first The offset in the original file of the first byte to decode.
+ * @param length The number of bytes to decode.
+ * @throws std::runtime_error If a block cannot be read or is invalid.
+ */
+void decode_blocks_range(OutputBuffer &output, std::istream &inputFile,
+                         const std::vector<BlockInfo> &blocks,
+                         const DecodeTable &table, const FileHeader &header,
+                         unsigned long long first, unsigned long long length) {
+  unsigned long long last = first + std::min(length, ~0ULL - first);
+  std::vector<unsigned char> payload;
+  std::vector<unsigned char> decoded;
+
+  for (const BlockInfo &block : blocks) {
+    unsigned long long blockStart = block.outputOffset;
+    unsigned long long blockEnd = blockStart + block.rawSize;
+    if (blockEnd <= first || blockStart >= last) {
+      continue;
+    }
+
+    unsigned long long from = std::max(first, blockStart) - blockStart;
+    unsigned long long to = std::min(last, blockEnd) - blockStart;
+
+    // Only the part of a stored block that is in the range is read
+    if (block.type == BLOCK_STORED) {
+      payload.resize(to - from);
+      inputFile.seekg(block.payloadOffset + from);
+      if (!inputFile.read(reinterpret_cast<char *>(payload.data()),
+                          payload.size())) {
+        throw std::runtime_error("Unexpected end of file in block.");
+      }
+      output.write(payload.data(), payload.size());
+      continue;
+    }
+
+    payload.resize(block.payloadSize);
+    decoded.resize(block.rawSize);
+    inputFile.seekg(block.payloadOffset);
+    if (!inputFile.read(reinterpret_cast<char *>(payload.data()),
+                        payload.size())) {
+      throw std::runtime_error("Unexpected end of file in block.");
+    }
+    decode_file_block(payload.data(), payload.size(), decoded.data(),
+                      decoded.size(), table, header);
+    output.write(decoded.data() + from, to - from);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Packs rounds of four or eight interleaved sub-streams with AVX2.
+ *
+ * The pending bits of four sub-streams sit in the 64 bit lanes of one YMM
+ * register, two registers for eight. Every round gathers the codes of the
+ * round's bytes from a packed copy of the table, shifts each lane left by its
+ * own code length with a variable shift and ORs the code in, so a whole round
+ * is packed without a branch per sub-stream.
+ *
+ * The longest code decides how many rounds fit in a lane before it must be
+ * emptied. The lanes are then stored and every sub-stream writes its whole
+ * bytes with one 8 byte store, which needs 8 bytes of room past the end of
+ * each output. Fewer than 8 bits are left pending in every lane when the
+ * kernel returns, so the scalar loop in encode_interleaved carries on where
+ * it stopped. A gathered length of 0 is a byte with no code, which is checked
+ * for once per batch before its bytes are written.
+ *
+ * @param data The bytes to encode, starting at the beginning of a round.
+ * @param size The number of bytes in data.
+ * @param table The look-up table mapping bytes to their Huffman codes.
+ * @param streams The number of sub-streams.
+ * @param pending The bits not yet written to each sub-stream.
+ * @param pendingBits The number of bits pending for each sub-stream, fewer
+ * than 8.
+ * @param outputs Where the next byte of each sub-stream is written, moved on
+ * past the bytes written.
+ * @return The number of bytes encoded, a whole number of rounds. This is 0
+ * when there are not four or eight sub-streams, a code is longer than 56
+ * bits or the CPU has no AVX2.
+ * @throws std::runtime_error If a byte has no code in table.
+ */
+__attribute__((target("avx2"))) size_t
+encode_rounds_avx2(const unsigned char *data, size_t size,
+                   const EncodeTable &table, int streams,
+                   unsigned long long *pending, int *pendingBits,
+                   unsigned char **outputs) {
+  if ((streams != 4 && streams != 8) || !__builtin_cpu_supports("avx2")) {
+    return 0;
+  }
+
+  // Every entry holds the code in its low 56 bits and the length above them
+  alignas(32) long long packed[256];
+  int maxLength = 0;
+  for (int i = 0; i < 256; i++) {
+    packed[i] = static_cast<long long>(
+        table[i].code | static_cast<unsigned long long>(table[i].length) << 56);
+    maxLength = std::max(maxLength, table[i].length);
+  }
+  if (maxLength == 0 || maxLength > 56) {
+    return 0;
+  }
+
+  // With fewer than 8 bits pending, this many codes always leave a lane with
+  // at most 63 bits
+  const size_t batch = 56 / maxLength;
+  const int groups = streams / 4;
+  const size_t rounds = size / streams;
+  const __m256i codeMask = _mm256_set1_epi64x((1LL << 56) - 1);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i missing = zero;
+
+  alignas(32) unsigned long long bits[8];
+  alignas(32) unsigned long long counts[8];
+  __m256i lanes[2];
+  __m256i lengths[2];
+  for (int k = 0; k < streams; k++) {
+    bits[k] = pending[k];
+    counts[k] = pendingBits[k];
+  }
+  for (int g = 0; g < groups; g++) {
+    lanes[g] =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(bits + 4 * g));
+    lengths[g] =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(counts + 4 * g));
+  }
+
+  size_t round = 0;
+  while (round < rounds) {
+    size_t end = std::min(rounds, round + batch);
+    for (; round < end; round++) {
+      const unsigned char *bytes = data + round * streams;
+      for (int g = 0; g < groups; g++) {
+        int word;
+        std::memcpy(&word, bytes + 4 * g, 4);
+        __m128i index = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(word));
+        __m256i entry = _mm256_i32gather_epi64(packed, index, 8);
+        __m256i length = _mm256_srli_epi64(entry, 56);
+        missing = _mm256_or_si256(missing, _mm256_cmpeq_epi64(length, zero));
+        lanes[g] = _mm256_or_si256(_mm256_sllv_epi64(lanes[g], length),
+                                   _mm256_and_si256(entry, codeMask));
+        lengths[g] = _mm256_add_epi64(lengths[g], length);
+      }
+    }
+
+    if (!_mm256_testz_si256(missing, missing)) {
+      throw std::runtime_error("Data holds a byte with no Huffman code.");
+    }
+
+    // Write the whole bytes of every lane, keeping the rest pending
+    for (int g = 0; g < groups; g++) {
+      _mm256_store_si256(reinterpret_cast<__m256i *>(bits + 4 * g), lanes[g]);
+      _mm256_store_si256(reinterpret_cast<__m256i *>(counts + 4 * g),
+                         lengths[g]);
+    }
+    for (int k = 0; k < streams; k++) {
+      int count = static_cast<int>(counts[k]);
+      store_big_endian_64(outputs[k], (bits[k] << (63 - count)) << 1);
+      outputs[k] += count >> 3;
+      counts[k] = count & 7;
+    }
+    for (int g = 0; g < groups; g++) {
+      lengths[g] =
+          _mm256_load_si256(reinterpret_cast<const __m256i *>(counts + 4 * g));
+    }
+  }
+
+  for (int g = 0; g < groups; g++) {
+    _mm256_store_si256(reinterpret_cast<__m256i *>(bits + 4 * g), lanes[g]);
+  }
+  for (int k = 0; k < streams; k++) {
+    pending[k] = bits[k];
+    pendingBits[k] = static_cast<int>(counts[k]);
+  }
+  return rounds * streams;
+}
+#else
+/**
+ * Stands in for the AVX2 packer on CPUs without it.
+ *
+ * @return 0, leaving every round to the scalar loop in encode_interleaved.
+ */
+size_t encode_rounds_avx2(const unsigned char *data, size_t size,
+                          const EncodeTable &table, int streams,
+                          unsigned long long *pending, int *pendingBits,
+                          unsigned char **outputs) {
+  return 0;
+}
+#endif
+
+/**
+ * Encodes data into several round-robin sub-streams.
+ *
+ * Byte i of the data is encoded into sub-stream i % streams, and each
+ * sub-stream is bit-packed on its own with its last byte padded with zeros.
+ * This is the layout decode_interleaved reads.
+ *
+ * The data is encoded ENCODE_CHUNK_ROUNDS rounds at a time, and before each
+ * chunk every sub-stream's buffer grows by the longest the chunk's codes
+ * could be. The buffers so stay close to the size of the coded data rather
+ * than the longest possible output of the whole input. Four or eight
+ * sub-streams are packed with encode_rounds_avx2 when simd is set and the CPU
+ * supports it, which leaves any bytes past the last whole round of a chunk to
+ * the scalar loop. Both give the same bytes. A single
+ * sub-stream of at least MIN_PAIR_ENCODE_SIZE bytes is encoded two bytes at a
+ * time from a pair table when its codes are short enough.
+ *
+ * @param data The bytes to encode.
+ * @param size The number of bytes in data.
+ * @param table The look-up table mapping bytes to their Huffman codes.
+ * @param streams The number of sub-streams to split the data over.
+ * @param simd Whether to pack the sub-streams with AVX2 when possible.
+ * @return The packed bytes of every sub-stream.
+ * @throws std::runtime_error If a byte has no code in table.
+ */
+std::vector<std::vector<unsigned char>>
+encode_interleaved(const unsigned char *data, size_t size,
+                   const EncodeTable &table, int streams, bool simd) {
+  int maxLength = 0;
+  for (const EncodeEntry &entry : table) {
+    maxLength = std::max(maxLength, entry.length);
+  }
+
+  std::vector<std::vector<unsigned char>> packed(streams);
+  std::vector<unsigned char *> outputs(streams);
+  for (int k = 0; k < streams; k++) {
+    outputs[k] = packed[k].data();
+  }
+  std::vector<unsigned long long> pending(streams, 0);
+  std::vector<int> pendingBits(streams, 0);
+
+  // A single stream takes the codes of two bytes at a time from a pair table
+  PairTable pairs;
+  if (streams == 1 && size >= MIN_PAIR_ENCODE_SIZE) {
+    pairs = create_pair_table(table);
+  }
+
+  // Every chunk is a whole number of rounds, so each starts on sub-stream 0
+  const size_t chunkSize = ENCODE_CHUNK_ROUNDS * streams;
+  for (size_t chunk = 0; chunk < size; chunk += chunkSize) {
+    size_t end = std::min(size, chunk + chunkSize);
+
+    // Grow every sub-stream by the longest the chunk's codes could be, with
+    // room for the 8 byte stores of the AVX2 kernel past the last byte
+    size_t symbols = (end - chunk + streams - 1) / streams;
+    for (int k = 0; k < streams; k++) {
+      size_t used = outputs[k] - packed[k].data();
+      packed[k].resize(used + (symbols * maxLength + 7) / 8 + 8);
+      outputs[k] = packed[k].data() + used;
+    }
+
+    size_t i = chunk;
+    if (simd) {
+      i += encode_rounds_avx2(data + chunk, end - chunk, table, streams,
+                              pending.data(), pendingBits.data(),
+                              outputs.data());
+    }
+
+    if (!pairs.empty()) {
+      for (; i + 1 < end; i += 2) {
+        unsigned long long entry = pairs[data[i] << 8 | data[i + 1]];
+        if (entry == 0) {
+          throw std::runtime_error("Data holds a byte with no Huffman code.");
+        }
+        int length = static_cast<int>(entry >> 56);
+        pending[0] = (pending[0] << length) | (entry & ((1ULL << 56) - 1));
+        pendingBits[0] += length;
+        while (pendingBits[0] >= 8) {
+          pendingBits[0] -= 8;
+          *outputs[0]++ =
+              static_cast<unsigned char>(pending[0] >> pendingBits[0]);
+        }
+      }
+    }
+
+    for (int stream = 0; i < end; i++) {
+      // Fewer than 8 bits are ever left pending, so a whole code always fits
+      const EncodeEntry &entry = table[data[i]];
+      if (entry.length == 0) {
+        throw std::runtime_error("Data holds a byte with no Huffman code.");
+      }
+      pending[stream] = (pending[stream] << entry.length) | entry.code;
+      pendingBits[stream] += entry.length;
+      while (pendingBits[stream] >= 8) {
+        pendingBits[stream] -= 8;
+        *outputs[stream]++ =
+            static_cast<unsigned char>(pending[stream] >> pendingBits[stream]);
+      }
+      stream = stream + 1 == streams ? 0 : stream + 1;
+    }
+  }
+
+  // Pad the last byte of every sub-stream with 0s
+  for (int k = 0; k < streams; k++) {
+    if (pendingBits[k] > 0) {
+      *outputs[k]++ =
+          static_cast<unsigned char>(pending[k] << (8 - pendingBits[k]));
+    }
+    packed[k].resize(outputs[k] - packed[k].data());
+  }
+
+  return packed;
+}
+
+/**
+ * Writes the codes of a run of bytes to a single bitstream.
+ *
+ * With a pair table the bytes are looked up and written two at a time, which
+ * halves the lookups and BitWriter writes for the common case of short codes.
+ * An odd last byte, or every byte without a pair table, is written on its own.
+ *
+ * @param writer Where the codes are written.
+ * @param data The bytes to encode.
+ * @param size The number of bytes in data.
+ * @param table The look-up table mapping bytes to their Huffman codes.
+ * @param pairs The pair table built from table, or an empty table.
+ * @throws std::runtime_error If a byte has no code in table.
+ */
+void encode_bytes(BitWriter &writer, const unsigned char *data, size_t size,
+                  const EncodeTable &table, const PairTable &pairs) {
+  size_t i = 0;
+  if (!pairs.empty()) {
+    const unsigned long long codeMask = (1ULL << 56) - 1;
+    for (; i + 1 < size; i += 2) {
+      unsigned long long entry = pairs[data[i] << 8 | data[i + 1]];
+      if (entry == 0) {
+        throw std::runtime_error("Data holds a byte with no Huffman code.");
+      }
+      writer.write(entry & codeMask, static_cast<int>(entry >> 56));
+    }
+  }
+  for (; i < size; i++) {
+    const EncodeEntry &entry = table[data[i]];
+    if (entry.length == 0) {
+      throw std::runtime_error("Data holds a byte with no Huffman code.");
+    }
+    writer.write(entry.code, entry.length);
+  }
+}
+
+/**
+ * Encodes one block of a file split into blocks.
+ *
+ * The block is encoded with encode_interleaved and its sub-streams are joined
+ * behind a jump table of the sizes of all but the last, which is the payload
+ * decode_block reads.
+ *
+ * @param data The bytes of the block.
+ * @param size The number of bytes in the block.
+ * @param table The look-up table mapping bytes to their Huffman codes.
+ * @param streams The number of sub-streams to split the block over.
+ * @param simd Whether to pack the sub-streams with AVX2 when possible.
+ * @return The payload of the block.
+ */
+std::vector<unsigned char>
+encode_block(const unsigned char *data, size_t size, const EncodeTable &table,
+             int streams, bool simd) {
+  std::vector<std::vector<unsigned char>> packed =
+      encode_interleaved(data, size, table, streams, simd);
+
+  std::vector<unsigned char> payload;
+  for (int i = 0; i < streams - 1; i++) {
+    std::vector<unsigned char> bytes = int_to_bytes(packed[i].size());
+    payload.insert(payload.end(), bytes.begin(), bytes.end());
+  }
+  for (auto &stream : packed) {
+    payload.insert(payload.end(), stream.begin(), stream.end());
+  }
+  return payload;
+}
+
+/**
+ * Encodes one block with a code table built from its own bytes.
+ *
+ * The bytes of the block are counted and turned into a Huffman tree, and the
+ * payload is the size of the code table (the tree packet or, with canonical,
+ * the 256 code lengths), the code table and then the block encoded like
+ * encode_block. This is the payload decode_file_block reads for files with
+ * FLAG_BLOCK_TABLES.
+ *
+ * Before encoding, get_coded_bits gives how large the payload could be. When
+ * that is no smaller than the block, as for random or already compressed
+ * data, the block is stored instead and its payload is its bytes as they are.
+ *
+ * @param data The bytes of the block.
+ * @param size The number of bytes in the block, at least 1.
+ * @param block Set to the type, raw size and payload size of the block.
+ * @param canonical Whether to assign canonical codes and store their lengths.
+ * @param streams The number of sub-streams to split the block over.
+ * @param simd Whether to pack the sub-streams with AVX2 when possible.
+ * @return The payload of the block.
+ */
+std::vector<unsigned char>
+encode_block_with_table(const unsigned char *data, size_t size,
+                        BlockInfo &block, bool canonical, int streams,
+                        bool simd) {
+  Histogram occurrences = get_occurrences(data, size);
+  std::vector<Node *> occurrenceNodes = get_occurrence_nodes(occurrences);
+  Node *huffmanHead = create_huffman_tree(occurrenceNodes);
+
+  std::vector<unsigned char> codeTable;
+  EncodeTable table;
+  try {
+    codeTable = canonical ? get_code_lengths(huffmanHead)
+                          : get_tree_packet(huffmanHead);
+    table = create_encode_table(huffmanHead, canonical);
+  } catch (...) {
+    delete huffmanHead;
+    throw;
+  }
+  delete huffmanHead;
+
+  // Every sub-stream but one may end in a byte of padding
+  block.rawSize = size;
+  unsigned long long codedSize = 4 + codeTable.size() + 4 * (streams - 1) +
+                                 (get_coded_bits(occurrences, table) + 7) / 8 +
+                                 (streams - 1);
+  if (codedSize >= size) {
+    block.type = BLOCK_STORED;
+    block.payloadSize = size;
+    return std::vector<unsigned char>(data, data + size);
+  }
+
+  std::vector<unsigned char> payload = int_to_bytes(codeTable.size());
+  payload.insert(payload.end(), codeTable.begin(), codeTable.end());
+  std::vector<unsigned char> coded =
+      encode_block(data, size, table, streams, simd);
+  payload.insert(payload.end(), coded.begin(), coded.end());
+  block.type = BLOCK_HUFFMAN;
+  block.payloadSize = payload.size();
+  return payload;
+}
+
+/**
+ * Reads a file a block at a time and encodes the blocks on several threads.
+ *
+ * The calling thread reads blocks into a ring of 2 * threads slots and
+ * writes encoded blocks out in file order, while the worker threads take
+ * filled slots from a queue and encode them with encode_block_with_table.
+ * Reading, encoding and writing all overlap, and no more than the ring's
+ * blocks are held in memory however large the file is. A slot is only
+ * refilled once its block has been written.
+ *
+ * The first error any thread hits stops the others and is rethrown once every
+ * thread has finished.
+ *
+ * @param inputFile The file to encode, read from its current position.
+ * @param outputFile Where the block headers and payloads are written.
+ * @param blockSize The number of bytes in every block but the last.
+ * @param canonical Whether to assign canonical codes and store their lengths.
+ * @param streams The number of sub-streams to split every block over.
+ * @param threads The number of threads to encode with, 0 for one per hardware
+ * thread.
+ * @param simd Whether to pack the sub-streams with AVX2 when possible.
+ * @throws std::runtime_error If the output cannot be written.
+ */
+void encode_blocks(std::istream &inputFile, std::ostream &outputFile,
+                   size_t blockSize, bool canonical, int streams, int threads,
+                   bool simd) {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // A slot is empty, waiting for a worker or holding an encoded block
+  enum SlotState { SLOT_EMPTY, SLOT_FILLED, SLOT_ENCODED };
+  struct Slot {
+    SlotState state = SLOT_EMPTY;
+    std::vector<unsigned char> data;
+    size_t size = 0;
+    BlockInfo block;
+    std::vector<unsigned char> payload;
+  };
+
+  const size_t slotCount = 2 * threads;
+  std::vector<Slot> slots(slotCount);
+  std::vector<size_t> queue;
+  std::mutex mutex;
+  std::condition_variable workReady;
+  std::condition_variable blockEncoded;
+  bool finished = false;
+  std::exception_ptr error;
+
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      workReady.wait(lock, [&]() { return finished || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      Slot &slot = slots[queue.front()];
+      queue.erase(queue.begin());
+
+      lock.unlock();
+      try {
+        BlockInfo block;
+        std::vector<unsigned char> payload = encode_block_with_table(
+            slot.data.data(), slot.size, block, canonical, streams, simd);
+        lock.lock();
+        slot.payload.swap(payload);
+        slot.block = block;
+        slot.state = SLOT_ENCODED;
+      } catch (...) {
+        lock.lock();
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      blockEncoded.notify_one();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+
+  try {
+    size_t nextRead = 0;
+    size_t nextWrite = 0;
+    bool endOfFile = false;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!error && (!endOfFile || nextWrite < nextRead)) {
+      Slot &writeSlot = slots[nextWrite % slotCount];
+      if (nextWrite < nextRead && writeSlot.state == SLOT_ENCODED) {
+        // Write the next block in file order
+        lock.unlock();
+        write_block_header(outputFile, writeSlot.block);
+        outputFile.write(
+            reinterpret_cast<const char *>(writeSlot.payload.data()),
+            writeSlot.payload.size());
+        if (!outputFile) {
+          throw std::runtime_error("Failed to write the output file.");
+        }
+        lock.lock();
+        writeSlot.state = SLOT_EMPTY;
+        nextWrite++;
+      } else if (!endOfFile && nextRead - nextWrite < slotCount) {
+        // Read the next block into a free slot
+        Slot &readSlot = slots[nextRead % slotCount];
+        lock.unlock();
+        readSlot.data.resize(blockSize);
+        inputFile.read(reinterpret_cast<char *>(readSlot.data.data()),
+                       blockSize);
+        readSlot.size = inputFile.gcount();
+        lock.lock();
+        if (readSlot.size == 0) {
+          endOfFile = true;
+          continue;
+        }
+        endOfFile = !inputFile;
+        readSlot.state = SLOT_FILLED;
+        queue.push_back(nextRead % slotCount);
+        nextRead++;
+        workReady.notify_one();
+      } else {
+        blockEncoded.wait(lock);
+      }
+    }
+
+    finished = true;
+    workReady.notify_all();
+  } catch (...) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!error) {
+      error = std::current_exception();
+    }
+    finished = true;
+    workReady.notify_all();
+  }
+
+  // Workers still drain the queue, the blocks are simply never written
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
 
 /**
  * Decompresses a file that was compressed using Huffman coding.
  *
- * This function is a wrapper for the decompress_helper function. It first
+ * This function is a wrapper for the decompress_table function. It first
  * checks if the head of the Huffman tree is null. If it is, it throws an
- * invalid_argument exception. Otherwise, it calls the decompress_helper
+ * invalid_argument exception. Otherwise, it calls the decompress_table
  * function to decompress the file.
  *
  * @param head The root of the Huffman tree used for decompression.
@@ -72,14 +1339,16 @@ void decompress_helper(std::ofstream &outputFile, std::ifstream &inputFile,
  * @param inputFile The compressed file to be decompressed.
  * @param remainder The number of remainder bits in the last byte of the input
  * file.
+ * @param multiSymbol Whether to decode several bytes per lookup when their
+ * codes fit.
  */
-void decompress(Node *head, std::ofstream &outputFile, std::ifstream &inputFile,
-                int remainder) {
+void decompress(Node *head, std::ostream &outputFile, std::istream &inputFile,
+                int remainder, bool multiSymbol) {
   if (head == nullptr) {
     throw std::invalid_argument("Invalid Huffman tree, head received is null.");
   }
 
-  decompress_helper(outputFile, inputFile, head, remainder);
+  decompress_table(outputFile, inputFile, head, remainder, multiSymbol);
 }
 
 /**
@@ -96,8 +1365,9 @@ void decompress(Node *head, std::ofstream &outputFile, std::ifstream &inputFile,
  * data.
  *
  * @param file The path to the Huffman-compressed file to be decompressed.
+ * @param options The options controlling how the file is decompressed.
  */
-void decompress_data(std::string file) {
+void decompress_data(std::string file, const DecompressOptions &options) {
   std::ifstream inputFile(file, std::ios::binary);
   if (!inputFile) {
     throw std::runtime_error("Failed to open the file.");
@@ -112,89 +1382,474 @@ void decompress_data(std::string file) {
         "Invalid file type, please select an hcmp file for decompressing");
   }
 
-  int remainder;
-  inputFile.read(reinterpret_cast<char *>(&remainder), sizeof(remainder));
+  FileHeader header = read_header(inputFile);
+  std::string outputName = filename + "(unzp)." + header.extension;
 
-  int extensionSize;
-  inputFile.read(reinterpret_cast<char *>(&extensionSize),
-                 sizeof(extensionSize));
-
-  // Get the extension (4 bytes in a vector of unsigned char)
-  std::vector<unsigned char> extensionData(extensionSize);
-  inputFile.read(reinterpret_cast<char *>(extensionData.data()), extensionSize);
-  std::string extension(extensionData.begin(), extensionData.end());
+  // A range can be found from the seek index or the block table, but there is
+  // no way into the middle of an unblocked interleaved file
+  bool blocks = header.flags & FLAG_BLOCKS;
+  bool interleaved = header.flags & FLAG_INTERLEAVED;
+  if (options.range && interleaved && !blocks) {
+    throw std::runtime_error(
+        "Range decompression needs a single stream or blocks.");
+  }
 
-  int treeSize;
-  inputFile.read(reinterpret_cast<char *>(&treeSize), sizeof(treeSize));
+  // Decoded bytes are collected in one large buffer, written either through a
+  // stream or straight to the file with writev. Whole files of blocks are
+  // written straight to their place in the file by several threads, so they
+  // always need a file descriptor.
+  bool parallel = blocks && !options.range;
+  std::ofstream outputFile;
+  int outputFd = -1;
+  if (options.writev || parallel) {
+    outputFd = open(outputName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outputFd < 0) {
+      throw std::runtime_error("Failed to open the output file.");
+    }
+  } else {
+    outputFile.open(outputName, std::ios::binary);
+    if (!outputFile) {
+      throw std::runtime_error("Failed to open the output file.");
+    }
+  }
 
-  std::vector<unsigned char> treeData(treeSize);
-  inputFile.read(reinterpret_cast<char *>(treeData.data()), treeSize);
+  // Every round of the interleaved decoder takes one byte per sub-stream, so
+  // multi-symbol lookups only apply to a single bitstream
+  bool multiSymbol = options.multiSymbol && !interleaved && !blocks;
+  int tableBits = multiSymbol ? MULTI_TABLE_BITS : DECODE_TABLE_BITS;
 
-  Node *huffmanHead = tree_reconstructor(treeData);
+  // With a code table per block, the file's table only holds the settings
+  // every block's table is built with
+  DecodeTable table;
+  table.tableBits = tableBits;
+  if (!(header.flags & FLAG_BLOCK_TABLES)) {
+    table = build_code_table(header.codeTable, header.flags & FLAG_CANONICAL,
+                             tableBits);
+  }
+  if (multiSymbol) {
+    add_multi_symbol_entries(table);
+  }
+  table.simd = options.simd;
 
-  std::ofstream outputFile(filename + "(unzp)." + extension, std::ios::binary);
-  if (!outputFile) {
-    throw std::runtime_error("Failed to open the output file.");
+  // The seek index sits between the bitstream and the end of the file
+  std::vector<Checkpoint> index;
+  long long dataEnd = -1;
+  if (header.flags & FLAG_INDEX) {
+    index = read_seek_index(inputFile, dataEnd);
   }
 
-  decompress(huffmanHead, outputFile, inputFile, remainder);
+  try {
+    if (parallel) {
+      std::vector<BlockInfo> blockTable = read_block_table(inputFile);
+      int inputFd = open(file.c_str(), O_RDONLY);
+      if (inputFd < 0) {
+        throw std::runtime_error("Failed to open the file.");
+      }
+      try {
+        decode_blocks(inputFd, outputFd, blockTable, table, header,
+                      options.threads);
+      } catch (...) {
+        close(inputFd);
+        throw;
+      }
+      close(inputFd);
+    } else {
+      std::unique_ptr<OutputBuffer> output;
+      if (outputFd >= 0) {
+        output.reset(new OutputBuffer(outputFd, options.bufferSize));
+      } else {
+        output.reset(new OutputBuffer(outputFile, options.bufferSize));
+      }
 
-  delete huffmanHead;
+      if (options.range && blocks) {
+        decode_blocks_range(*output, inputFile, read_block_table(inputFile),
+                            table, header, options.rangeStart,
+                            options.rangeLength);
+      } else if (options.range) {
+        decode_range(*output, inputFile, table, index, header.remainder,
+                     dataEnd, options.rangeStart, options.rangeLength);
+      } else if (interleaved) {
+        decode_interleaved(*output, inputFile, table, header);
+      } else {
+        decode_bitstream(*output, inputFile, table, header.remainder, dataEnd);
+      }
+      output->flush();
+    }
+  } catch (...) {
+    if (outputFd >= 0) {
+      close(outputFd);
+    }
+    throw;
+  }
+
+  if (outputFd >= 0 && close(outputFd) != 0) {
+    throw std::runtime_error("Failed to write the output file.");
+  }
 
   std::cout << "Data successfully decompressed." << std::endl;
 }
 
 /**
- * Compresses a file using Huffman coding.
+ * Checks that a set of compression options can be used together.
  *
- * This function opens the input file in binary mode and checks if it was opened
- * successfully. If not, it throws a runtime_error exception.
+ * @param options The options to check.
+ * @throws std::invalid_argument If the number of sub-streams or the block
+ * size is out of range, or a seek index is asked for with anything but a
+ * single unblocked stream.
+ */
+void check_compress_options(const CompressOptions &options) {
+  if (options.streams < 1 || options.streams > MAX_STREAMS) {
+    throw std::invalid_argument("Number of sub-streams must be 1 to 8.");
+  }
+
+  if (options.blockSize > static_cast<size_t>(MAX_BLOCK_SIZE)) {
+    throw std::invalid_argument("Block size is too large.");
+  }
+
+  if (options.indexInterval > 0 &&
+      (options.streams > 1 || options.blockSize > 0 || options.singlePass)) {
+    throw std::invalid_argument(
+        "A seek index is only written for a single unblocked stream.");
+  }
+
+  if (options.samplePercent < 0 || options.samplePercent > 100) {
+    throw std::invalid_argument("Sample percentage must be 0 to 100.");
+  }
+
+  if (options.samplePercent > 0 && options.singlePass) {
+    throw std::invalid_argument(
+        "Only a file read twice can be sampled, not in single-pass mode.");
+  }
+}
+
+/**
+ * Counts every byte of a mapped file and caches the counts.
  *
- * It then retrieves the name and extension of the input file. If the extension
- * is "hcmp" (indicating a Huffman-compressed file), it throws a runtime_error
- * exception.
+ * The bytes are counted on options.threads threads. With options.cacheDir
+ * set, the histogram is cached under the file's key for next time, replacing
+ * any histogram cached for the file before. A failure to cache it is reported
+ * but does not stop the compression.
  *
- * After validating the file, it calculates the frequency of each byte in the
- * file and uses this information to build a Huffman tree. It then uses this
- * tree to compress the data in the file.
+ * @param file The path to the file.
+ * @param input The mapping of the file.
+ * @param options The options the file is compressed with.
+ * @return The histogram of every byte of the file.
+ * @throws std::runtime_error If the file cannot be found for the cache key.
+ */
+Histogram count_file_occurrences(const std::string &file,
+                                 const MappedFile &input,
+                                 const CompressOptions &options) {
+  Histogram occurrences =
+      get_occurrences(input.data(), input.size(), options.threads);
+  if (!options.cacheDir.empty()) {
+    HistogramKey key = get_histogram_key(file, input.data(), input.size());
+    try {
+      store_cached_histogram(options.cacheDir, key, occurrences);
+    } catch (const std::runtime_error &e) {
+      std::cout << "Could not cache occurrences: " << e.what() << '\n';
+    }
+  }
+  return occurrences;
+}
+
+/**
+ * Counts the bytes of a mapped file for the tree of a two-pass compression.
  *
- * @param file The path to the file to be compressed.
+ * With options.cacheDir set, a cached histogram of the file is used when its
+ * key shows the file is unchanged, so the file is not read beyond the blocks
+ * hashed for the key. The cached counts are returned as they are, so the
+ * tree, the codes and the size estimate all match those of a fresh count.
+ * The key does not cover the middle of the file, so a cached histogram may
+ * be stale and miss a byte the file now holds. The encoders throw on such a
+ * byte, and compress_data then counts the file again with
+ * count_file_occurrences. Otherwise every byte is counted with
+ * count_file_occurrences, which caches the histogram for next time. With
+ * options.samplePercent a cached histogram is still used when there is one,
+ * and otherwise only a sample is counted, which is never cached as it is not
+ * the whole file.
+ *
+ * @param file The path to the file.
+ * @param input The mapping of the file.
+ * @param options The options the file is compressed with.
+ * @return The histogram to build the tree from.
+ * @throws std::runtime_error If the file cannot be found for the cache key.
  */
-void compress_data(std::string file) {
-  std::ifstream inputFile(file, std::ios::binary);
-  if (!inputFile) {
-    throw std::runtime_error("Failed to open the file.");
+Histogram get_file_occurrences(const std::string &file,
+                               const MappedFile &input,
+                               const CompressOptions &options) {
+  Histogram occurrences;
+  if (!options.cacheDir.empty()) {
+    HistogramKey key = get_histogram_key(file, input.data(), input.size());
+    if (load_cached_histogram(options.cacheDir, key, occurrences)) {
+      return occurrences;
+    }
   }
 
-  size_t dotPos = file.rfind('.');
-  std::string extension = file.substr(dotPos + 1);
-  std::string filename = file.substr(0, dotPos);
-  int extensionSize = extension.size();
+  if (options.samplePercent > 0) {
+    return get_sampled_occurrences(input.data(), input.size(),
+                                   options.samplePercent);
+  }
+  return count_file_occurrences(file, input, options);
+}
 
+/**
+ * Works out how large a file would be once compressed, without encoding it.
+ *
+ * The file is read once to count its bytes and build the same Huffman tree
+ * compress_data would, and get_coded_bits then gives the length of every code
+ * in the file from those counts alone. The header is sized by writing it to
+ * memory. In single-pass mode every block is counted and given its own tree
+ * in the same way. With options.samplePercent the tree is built from a sample
+ * as compress_data does, while the codes are still counted for every byte,
+ * and the size with every byte counted is worked out as well to show what
+ * sampling costs. The counts come from get_file_occurrences, so they are
+ * cached and reused with options.cacheDir as when compressing.
+ *
+ * How the codes fall into several sub-streams, or into blocks sharing one
+ * tree, is not known from the counts of the whole file, so in those cases
+ * every sub-stream is taken to need a padding byte and the size is an upper
+ * bound at most one byte per sub-stream too large. Blocks that compress_data
+ * stores because their codes turn out no smaller can only make the file
+ * smaller than this bound.
+ *
+ * @param file The path to the file to be compressed.
+ * @param options The options the file would be compressed with.
+ * @return The size of the file and of its compressed form.
+ * @throws std::runtime_error If the file cannot be opened, is already an hcmp
+ * file or is empty without single-pass mode.
+ * @throws std::invalid_argument If the options cannot be used together.
+ */
+SizeEstimate estimate_compressed_size(std::string file,
+                                      const CompressOptions &options) {
+  std::string extension = file.substr(file.rfind('.') + 1);
   if (extension == "hcmp") {
     throw std::runtime_error("Invalid file type, hcmp is already compressed");
   }
+  check_compress_options(options);
 
-  std::map<unsigned char, int> occurrences = get_occurrences(inputFile);
-  std::cout << "Retrieved occurrences" << '\n';
+  SizeEstimate estimate;
+  FileHeader header;
+  header.extension = extension;
+  if (options.canonical) {
+    header.flags |= FLAG_CANONICAL;
+  }
+  if (options.streams > 1) {
+    header.flags |= FLAG_INTERLEAVED;
+    header.streams = options.streams;
+  }
+  const unsigned long long jumpTableSize = 4 * (options.streams - 1);
+  unsigned long long padded = 0;
+
+  if (options.singlePass) {
+    header.flags |= FLAG_BLOCKS | FLAG_BLOCK_TABLES;
+    header.blockSize =
+        options.blockSize > 0 ? options.blockSize : DEFAULT_BLOCK_SIZE;
+    std::ifstream inputFile(file, std::ios::binary);
+    if (!inputFile) {
+      throw std::runtime_error("Failed to open the file.");
+    }
+
+    // Every block is counted and sized with its own tree
+    std::vector<unsigned char> data(header.blockSize);
+    while (inputFile.read(reinterpret_cast<char *>(data.data()), data.size()) ||
+           inputFile.gcount() > 0) {
+      size_t size = inputFile.gcount();
+      Histogram occurrences = get_occurrences(data.data(), size);
+      std::vector<Node *> occurrenceNodes = get_occurrence_nodes(occurrences);
+      Node *huffmanHead = create_huffman_tree(occurrenceNodes);
+
+      size_t codeTableSize;
+      EncodeTable table;
+      try {
+        codeTableSize =
+            options.canonical ? 256 : get_tree_packet(huffmanHead).size();
+        table = create_encode_table(huffmanHead, options.canonical);
+      } catch (...) {
+        delete huffmanHead;
+        throw;
+      }
+      delete huffmanHead;
+
+      // A block is stored when its payload might not be smaller, as in
+      // encode_block_with_table
+      unsigned long long payloadSize =
+          4 + codeTableSize + jumpTableSize +
+          (get_coded_bits(occurrences, table) + 7) / 8;
+      estimate.originalSize += size;
+      if (payloadSize + options.streams - 1 >= size) {
+        estimate.compressedSize += BLOCK_HEADER_SIZE + size;
+      } else {
+        estimate.compressedSize += BLOCK_HEADER_SIZE + payloadSize;
+        padded += options.streams - 1;
+      }
+    }
+  } else {
+    MappedFile input(file, options.populate);
+    CompressOptions full = options;
+    full.samplePercent = 0;
+    Histogram occurrences = get_file_occurrences(file, input, full);
+
+    // A sampled tree is built from part of the file, but every byte of the
+    // file is still coded with it
+    Histogram treeOccurrences = options.samplePercent > 0
+                                    ? get_file_occurrences(file, input, options)
+                                    : occurrences;
+    std::vector<Node *> occurrenceNodes =
+        get_occurrence_nodes(treeOccurrences);
+    Node *huffmanHead = create_huffman_tree(occurrenceNodes);
+
+    EncodeTable table;
+    try {
+      header.codeTable = options.canonical ? get_code_lengths(huffmanHead)
+                                           : get_tree_packet(huffmanHead);
+      table = create_encode_table(huffmanHead, options.canonical);
+    } catch (...) {
+      delete huffmanHead;
+      throw;
+    }
+    delete huffmanHead;
+
+    estimate.originalSize = input.size();
+    unsigned long long bits = get_coded_bits(occurrences, table);
+    estimate.compressedSize = (bits + 7) / 8;
+
+    // compress_data decides to store from the counts it built the tree from,
+    // and again from the real size of the codes once they are written, which
+    // every sub-stream but one may add a byte of padding to
+    unsigned long long codedSize =
+        (bits + 7) / 8 + (options.streams > 1 ? options.streams - 1 : 0);
+    if (options.blockSize == 0 &&
+        (header.codeTable.size() +
+                 (get_scaled_coded_bits(treeOccurrences, table,
+                                        estimate.originalSize) +
+                  7) / 8 >=
+             estimate.originalSize ||
+         header.codeTable.size() + codedSize >= estimate.originalSize)) {
+      // Written as stored blocks, as compress_data does
+      header = FileHeader();
+      header.extension = extension;
+      header.flags = FLAG_BLOCKS | FLAG_BLOCK_TABLES;
+      header.blockSize = DEFAULT_BLOCK_SIZE;
+      unsigned long long blocks =
+          (estimate.originalSize + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+      estimate.compressedSize =
+          blocks * BLOCK_HEADER_SIZE + estimate.originalSize;
+    } else if (options.blockSize > 0) {
+      header.flags |= FLAG_BLOCKS;
+      header.blockSize = options.blockSize;
+      unsigned long long blocks =
+          (estimate.originalSize + options.blockSize - 1) / options.blockSize;
+      if (blocks == 1 && options.streams == 1) {
+        // A single block is stored if its codes are no smaller
+        estimate.compressedSize =
+            std::min(estimate.compressedSize, estimate.originalSize);
+      }
+      estimate.compressedSize += blocks * (BLOCK_HEADER_SIZE + jumpTableSize);
+      padded = blocks * options.streams - std::min(blocks, 1ULL);
+    } else if (options.streams > 1) {
+      header.streamSizes.resize(options.streams - 1);
+      padded = options.streams - 1;
+    } else if (options.indexInterval > 0) {
+      // One checkpoint of two offsets every indexInterval bytes, then the
+      // number of checkpoints
+      unsigned long long checkpoints =
+          (estimate.originalSize + options.indexInterval - 1) /
+          options.indexInterval;
+      estimate.compressedSize += checkpoints * 16 + 8;
+    }
+  }
+
+  std::ostringstream headerBytes;
+  write_header(headerBytes, header);
+  estimate.compressedSize += headerBytes.str().size() + padded;
+  estimate.exact = padded == 0;
+  if (estimate.originalSize > 0) {
+    estimate.ratio = static_cast<double>(estimate.compressedSize) /
+                     estimate.originalSize;
+  }
+
+  if (options.samplePercent > 0) {
+    CompressOptions full = options;
+    full.samplePercent = 0;
+    estimate.fullCompressedSize =
+        estimate_compressed_size(file, full).compressedSize;
+  }
+  return estimate;
+}
+
+/**
+ * Writes a file as stored blocks holding its bytes as they are.
+ *
+ * This is the form compress_data writes data in that coding would not make
+ * smaller. The blocks are DEFAULT_BLOCK_SIZE bytes and every block is copied
+ * straight back out when decompressing.
+ *
+ * @param outputFile Where the header and blocks are written.
+ * @param extension The extension of the original file.
+ * @param data The bytes of the file.
+ * @param size The number of bytes in data.
+ */
+void write_stored_file(std::ostream &outputFile, const std::string &extension,
+                       const unsigned char *data, size_t size) {
+  FileHeader header;
+  header.extension = extension;
+  header.flags = FLAG_BLOCKS | FLAG_BLOCK_TABLES;
+  header.blockSize = DEFAULT_BLOCK_SIZE;
+  write_header(outputFile, header);
 
-  inputFile.clear();
-  inputFile.seekg(0, std::ios::beg);
+  for (size_t offset = 0; offset < size; offset += DEFAULT_BLOCK_SIZE) {
+    BlockInfo block;
+    block.type = BLOCK_STORED;
+    block.rawSize = std::min(DEFAULT_BLOCK_SIZE, size - offset);
+    block.payloadSize = block.rawSize;
+    write_block_header(outputFile, block);
+    outputFile.write(reinterpret_cast<const char *>(data + offset),
+                     block.payloadSize);
+  }
+}
 
+/**
+ * Writes the compressed form of a file from the counts of its bytes.
+ *
+ * This is the second pass of compress_data. A Huffman tree is built from
+ * occurrences, and the file's bytes are encoded with it in the layout
+ * options ask for, or written with write_stored_file when the codes would
+ * not make them smaller.
+ *
+ * @param outputName The path of the hcmp file to write.
+ * @param extension The extension of the original file.
+ * @param data The bytes of the file.
+ * @param size The number of bytes in data.
+ * @param occurrences The counts of the file's bytes to build the tree from.
+ * @param options The options controlling how the file is compressed.
+ * @throws std::runtime_error If a byte of the file has no code, as when
+ * occurrences misses it, or the output cannot be written.
+ */
+void write_compressed_file(const std::string &outputName,
+                           const std::string &extension,
+                           const unsigned char *data, size_t size,
+                           const Histogram &occurrences,
+                           const CompressOptions &options) {
   std::vector<Node *> occurrenceNodes = get_occurrence_nodes(occurrences);
   std::cout << "Retrieved occurrence nodes" << '\n';
 
   Node *huffmanHead = create_huffman_tree(occurrenceNodes);
   std::cout << "Created Huffman tree" << '\n';
 
-  // Pack the tree into a vector in preorder form to store in file
-  std::vector<unsigned char> packedTree = get_tree_packet(huffmanHead);
+  FileHeader header;
+  header.extension = extension;
 
-  // Get the size of the tree to also store in file
-  int treeSize = packedTree.size();
+  if (options.canonical) {
+    // Canonical codes can be rebuilt from the code lengths alone
+    header.flags |= FLAG_CANONICAL;
+    header.codeTable = get_code_lengths(huffmanHead);
+  } else {
+    // Pack the tree into a vector in preorder form to store in file
+    header.codeTable = get_tree_packet(huffmanHead);
+  }
 
   // Create a look up table using the huffman tree
-  std::map<unsigned char, std::string> table = createTable(huffmanHead);
+  EncodeTable table = create_encode_table(huffmanHead, options.canonical);
   std::cout << "Created table" << '\n';
 
   // Delete head node, this will activate the destructor and free all child
@@ -202,44 +1857,138 @@ void compress_data(std::string file) {
   delete huffmanHead;
   std::cout << "Deleted Huffman head" << '\n';
 
-  std::ofstream outputFile(filename + ".hcmp", std::ios::binary);
-  if (outputFile) {
+  // Data the codes would not make smaller, such as random or already
+  // compressed data, is written as stored blocks instead
+  bool stored =
+      options.blockSize == 0 &&
+      header.codeTable.size() +
+              (get_scaled_coded_bits(occurrences, table, size) + 7) / 8 >=
+          size;
+
+  std::ofstream outputFile(outputName, std::ios::binary);
+  if (outputFile && stored) {
+    std::cout << "Storing uncompressible data" << '\n';
+    write_stored_file(outputFile, extension, data, size);
+    outputFile.close();
+    std::cout << "Data successfully compressed." << std::endl;
+  } else if (outputFile && options.blockSize > 0) {
+    header.flags |= FLAG_BLOCKS;
+    header.blockSize = options.blockSize;
+    if (options.streams > 1) {
+      header.flags |= FLAG_INTERLEAVED;
+      header.streams = options.streams;
+    }
+    write_header(outputFile, header);
+
+    // Encode one block at a time, each behind its own block header
+    for (size_t offset = 0; offset < size; offset += options.blockSize) {
+      BlockInfo block;
+      block.rawSize = std::min(options.blockSize, size - offset);
+      std::vector<unsigned char> payload =
+          encode_block(data + offset, block.rawSize, table, options.streams,
+                       options.simd);
+      block.payloadSize = payload.size();
+
+      // Store a block its codes would not make smaller
+      const unsigned char *bytes = payload.data();
+      if (block.payloadSize >= block.rawSize) {
+        block.type = BLOCK_STORED;
+        block.payloadSize = block.rawSize;
+        bytes = data + offset;
+      }
+
+      write_block_header(outputFile, block);
+      outputFile.write(reinterpret_cast<const char *>(bytes),
+                       block.payloadSize);
+    }
+
+    outputFile.close();
+    std::cout << "Data successfully compressed." << std::endl;
+  } else if (outputFile && options.streams > 1) {
+    std::vector<std::vector<unsigned char>> packed = encode_interleaved(
+        data, size, table, options.streams, options.simd);
+
+    // Counts of a sample can hide that the codes are no smaller than the data
+    size_t codedSize = header.codeTable.size();
+    for (auto &stream : packed) {
+      codedSize += stream.size();
+    }
+
+    if (codedSize >= size) {
+      std::cout << "Storing uncompressible data" << '\n';
+      write_stored_file(outputFile, extension, data, size);
+    } else {
+      header.flags |= FLAG_INTERLEAVED;
+      header.streams = options.streams;
+      header.symbolCount = size;
+      for (int i = 0; i < options.streams - 1; i++) {
+        header.streamSizes.push_back(packed[i].size());
+      }
+
+      write_header(outputFile, header);
+      for (auto &stream : packed) {
+        outputFile.write(reinterpret_cast<const char *>(stream.data()),
+                         stream.size());
+      }
+    }
+
+    outputFile.close();
+    std::cout << "Data successfully compressed." << std::endl;
+  } else if (outputFile) {
     int paddingNum = get_padding_amount(occurrences, table);
-    outputFile.write(reinterpret_cast<const char *>(&paddingNum),
-                     sizeof(paddingNum));
-    outputFile.write(reinterpret_cast<const char *>(&extensionSize),
-                     sizeof(extensionSize));
-    outputFile.write((extension.c_str()), extensionSize);
-    outputFile.write(reinterpret_cast<const char *>(&treeSize),
-                     sizeof(treeSize));
-    outputFile.write(reinterpret_cast<const char *>(packedTree.data()),
-                     packedTree.size());
-    std::string buffer;
-    unsigned char byte;
-
-    // While the file being compressed is not empty, read a single byte from the
-    // file
-    while (inputFile.read(reinterpret_cast<char *>(&byte), sizeof(byte))) {
-      buffer += table[byte];
-
-      // If the buffer has at least 8 characters, enough to form a single byte,
-      // convert the buffer to a byte and write it to file
-      while (buffer.size() >= 8) {
-        std::string chunk = buffer.substr(0, 8);
-        buffer = buffer.substr(8);
-        unsigned char value =
-            static_cast<unsigned char>(std::stoi(chunk, nullptr, 2));
-        outputFile.write(reinterpret_cast<const char *>(&value), sizeof(value));
-      }
-    }
-
-    // Handle remaining bits in the buffer
-    if (!buffer.empty()) {
-      // Since the remaining bits are less then 8, pad the with 0s
-      buffer += std::string(paddingNum, '0');
-      unsigned char value =
-          static_cast<unsigned char>(std::stoi(buffer, nullptr, 2));
-      outputFile.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    header.remainder = paddingNum;
+    if (options.indexInterval > 0) {
+      header.flags |= FLAG_INDEX;
+    }
+    write_header(outputFile, header);
+
+    BitWriter writer(outputFile);
+    PairTable pairs;
+    if (size >= MIN_PAIR_ENCODE_SIZE) {
+      pairs = create_pair_table(table);
+    }
+    std::vector<Checkpoint> index;
+
+    // Write the code of every byte, noting where the next code starts every
+    // indexInterval bytes
+    size_t position = 0;
+    while (position < size) {
+      size_t run = size - position;
+      if (options.indexInterval > 0) {
+        Checkpoint checkpoint;
+        checkpoint.outputOffset = position;
+        checkpoint.bitOffset = writer.position();
+        index.push_back(checkpoint);
+        run = std::min(run, options.indexInterval);
+      }
+
+      encode_bytes(writer, data + position, run, table, pairs);
+      position += run;
+    }
+
+    // The last byte is padded with zeros. Sampled counts only estimate how
+    // many, so the remainder in the header is corrected when they were wrong.
+    int padding = writer.finish();
+
+    if (options.indexInterval > 0) {
+      write_seek_index(outputFile, index);
+    }
+    if (padding != paddingNum) {
+      outputFile.seekp(REMAINDER_OFFSET);
+      outputFile.put(static_cast<char>(padding));
+    }
+
+    // Counts of a sample can hide that the codes are no smaller than the
+    // data, which is only known once they are written. The file is then
+    // written again as stored blocks.
+    if (header.codeTable.size() + writer.position() / 8 >= size) {
+      outputFile.close();
+      outputFile.open(outputName, std::ios::binary | std::ios::trunc);
+      if (!outputFile) {
+        throw std::runtime_error("Failed to open the output file.");
+      }
+      std::cout << "Storing uncompressible data" << '\n';
+      write_stored_file(outputFile, extension, data, size);
     }
 
     outputFile.close();
@@ -248,3 +1997,117 @@ void compress_data(std::string file) {
     std::cout << "Failed to open the file." << std::endl;
   }
 }
+
+/**
+ * Compresses a file using Huffman coding.
+ *
+ * This function retrieves the name and extension of the input file. If the
+ * extension is "hcmp" (indicating a Huffman-compressed file), it throws a
+ * runtime_error exception. It then opens the input file and throws a
+ * runtime_error exception if it cannot be opened.
+ *
+ * After validating the file, it calculates the frequency of each byte in the
+ * file and uses this information to build a Huffman tree. It then uses this
+ * tree to compress the data in the file. Both passes read the file through one
+ * MappedFile, with every page read in up front when options.populate is set.
+ * With options.samplePercent the tree is built from evenly spaced chunks of
+ * the file instead, in which every byte value is given a code. With
+ * options.cacheDir the counts of an unchanged file are taken from the cache,
+ * which skips the first pass and gives the same output as counting the file.
+ * Should the cached counts turn out to miss a byte of the file, the file is
+ * counted again, the cache replaced and the file compressed once more.
+ *
+ * With options.canonical the codes are assigned canonically and only their
+ * lengths are stored in the file instead of the whole tree. With
+ * options.streams above 1 the data is split round-robin over that many
+ * separately packed sub-streams so it can be decoded in parallel. With
+ * options.blockSize set the data is coded in blocks of that many bytes which
+ * can be decoded independently of each other, all using the same codes. With
+ * options.indexInterval set a single bitstream is followed by a seek index
+ * with a checkpoint every that many bytes, so ranges can be decoded without
+ * starting from the beginning. With options.singlePass the file is read only
+ * once, a block at a time, and every block is coded with a tree built from
+ * its own bytes, which also works for pipes that cannot be read twice.
+ * options.threads sets how many threads the blocks are encoded on in this
+ * mode, and how many count the bytes of the file otherwise.
+ *
+ * Data that coding would not make smaller is written as stored blocks holding
+ * the bytes as they are, so it can be copied straight back out. Without
+ * options.blockSize this is decided for the whole file from the counts of its
+ * bytes and the file is then written with write_stored_file. Sampled counts
+ * only estimate the size of the codes, so a file whose codes turn out no
+ * smaller once encoded is stored as well. Otherwise every block is stored on
+ * its own once its codes turn out no smaller than its bytes.
+ *
+ * @param file The path to the file to be compressed.
+ * @param options The options controlling how the file is compressed.
+ */
+void compress_data(std::string file, const CompressOptions &options) {
+  size_t dotPos = file.rfind('.');
+  std::string extension = file.substr(dotPos + 1);
+  std::string filename = file.substr(0, dotPos);
+
+  if (extension == "hcmp") {
+    throw std::runtime_error("Invalid file type, hcmp is already compressed");
+  }
+
+  check_compress_options(options);
+
+  if (options.singlePass) {
+    // Every block gets its own tree, so the file is only read once
+    std::ifstream inputFile(file, std::ios::binary);
+    if (!inputFile) {
+      throw std::runtime_error("Failed to open the file.");
+    }
+
+    FileHeader header;
+    header.extension = extension;
+    header.flags = FLAG_BLOCKS | FLAG_BLOCK_TABLES;
+    header.blockSize =
+        options.blockSize > 0 ? options.blockSize : DEFAULT_BLOCK_SIZE;
+    if (options.canonical) {
+      header.flags |= FLAG_CANONICAL;
+    }
+    if (options.streams > 1) {
+      header.flags |= FLAG_INTERLEAVED;
+      header.streams = options.streams;
+    }
+
+    std::ofstream outputFile(filename + ".hcmp", std::ios::binary);
+    if (!outputFile) {
+      throw std::runtime_error("Failed to open the output file.");
+    }
+    write_header(outputFile, header);
+    encode_blocks(inputFile, outputFile, header.blockSize, options.canonical,
+                  options.streams, options.threads, options.simd);
+
+    outputFile.close();
+    std::cout << "Data successfully compressed." << std::endl;
+    return;
+  }
+
+  // Both passes read the file straight from the page cache through one
+  // mapping
+  MappedFile input(file, options.populate);
+  const unsigned char *data = input.data();
+  const size_t size = input.size();
+
+  Histogram occurrences = get_file_occurrences(file, input, options);
+  std::cout << "Retrieved occurrences" << '\n';
+
+  try {
+    write_compressed_file(filename + ".hcmp", extension, data, size,
+                          occurrences, options);
+  } catch (const std::runtime_error &) {
+    if (options.cacheDir.empty()) {
+      throw;
+    }
+    // Cached counts may be stale and miss a byte the file now holds, which
+    // the encoders reject. The file is counted again and the cache replaced,
+    // and any other error comes up again on the second attempt.
+    std::cout << "Cached occurrences may be stale, recounting" << '\n';
+    occurrences = count_file_occurrences(file, input, options);
+    write_compressed_file(filename + ".hcmp", extension, data, size,
+                          occurrences, options);
+  }
+}
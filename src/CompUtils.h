@@ -2,16 +2,204 @@
 #define COMP_UTILS_H
 
 #include "BitUtils.h"
+#include "DecodeUtils.h"
+#include "HeaderUtils.h"
+#include "IOUtils.h"
 #include "MapUtils.h"
 #include "TreeUtils.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 
+// Default number of original bytes per block when every block has its own
+// code table
+const size_t DEFAULT_BLOCK_SIZE = 1 << 20;
 
-void decompress_helper(std::ofstream &outputFile, std::ifstream &inputFile,
-                      Node *head, int remainder);
-void decompress(Node *head, std::ofstream &outputFile, std::ifstream &inputFile,
-                int remainder);
-void decompress_data(std::string file);
-void compress_data(std::string file);
+// Default number of original bytes between checkpoints of the seek index
+const size_t DEFAULT_INDEX_INTERVAL = 1 << 20;
+
+// Percentage of the file --sample counts when no percentage is given
+const double DEFAULT_SAMPLE_PERCENT = 1;
+
+// Fewest bytes a single sub-stream must hold before building a pair table to
+// encode it with pays for itself
+const size_t MIN_PAIR_ENCODE_SIZE = 1 << 18;
+
+// Rounds of interleaved sub-streams encoded between growing their buffers
+const size_t ENCODE_CHUNK_ROUNDS = 1 << 16;
+
+// Options for compress_data, the defaults match the original behaviour
+struct CompressOptions {
+  // Assign canonical codes and store only their lengths
+  bool canonical = false;
+
+  // Number of round-robin sub-streams to split the data over, 1 for a single
+  // serial bitstream
+  int streams = 1;
+
+  // Number of original bytes per independently coded block, 0 to code the
+  // whole file as one bitstream
+  size_t blockSize = 0;
+
+  // Number of original bytes between the checkpoints of the seek index, 0 to
+  // write no index
+  size_t indexInterval = 0;
+
+  // Read the file only once, coding every block (of blockSize bytes, or
+  // DEFAULT_BLOCK_SIZE) with a code table built from just that block
+  bool singlePass = false;
+
+  // Number of threads encoding blocks in single-pass mode, or counting the
+  // bytes of the file otherwise, 0 for one per hardware thread
+  int threads = 1;
+
+  // Pack four or eight sub-streams at once with AVX2 when the CPU supports it
+  bool simd = true;
+
+  // Read every page of the input in when it is mapped, rather than as the
+  // first pass reaches it
+  bool populate = false;
+
+  // Build the codes from evenly spaced chunks making up this percentage of
+  // the file rather than from every byte, 0 to count every byte
+  double samplePercent = 0;
+
+  // Directory the byte counts of whole files are cached in, so an unchanged
+  // file is not counted again, empty for no cache
+  std::string cacheDir;
+};
+
+// The sizes estimate_compressed_size works out for a file
+struct SizeEstimate {
+  // Number of bytes in the original file
+  unsigned long long originalSize = 0;
+
+  // Number of bytes in the compressed file, or an upper bound on it when
+  // exact is false
+  unsigned long long compressedSize = 0;
+
+  // Whether compressedSize is the size compress_data would write
+  bool exact = true;
+
+  // compressedSize divided by originalSize, 0 for an empty file
+  double ratio = 0;
+
+  // Only with a sampled count, compressedSize for the same options with every
+  // byte counted
+  unsigned long long fullCompressedSize = 0;
+};
+
+// Options for decompress_data, the defaults match the original behaviour
+struct DecompressOptions {
+  // Decode several bytes per table lookup when their codes fit
+  bool multiSymbol = false;
+
+  // Size of the buffer decoded bytes are collected in before being written
+  size_t bufferSize = DEFAULT_OUTPUT_BUFFER;
+
+  // Write the output file with writev rather than through a stream
+  bool writev = false;
+
+  // Decode eight sub-streams at once with AVX2 when the CPU supports it
+  bool simd = true;
+
+  // Number of threads decoding the blocks of a file split into blocks, 0 for
+  // one per hardware thread
+  int threads = 0;
+
+  // Decode only rangeLength bytes starting at rangeStart
+  bool range = false;
+  unsigned long long rangeStart = 0;
+  unsigned long long rangeLength = 0;
+};
+
+void decompress_helper(std::ostream &outputFile, std::istream &inputFile,
+                       Node *head, int remainder);
+void decode_bitstream(OutputBuffer &output, std::istream &inputFile,
+                      const DecodeTable &table, int remainder,
+                      long long end = -1);
+void decompress_table(std::ostream &outputFile, std::istream &inputFile,
+                      Node *head, int remainder, bool multiSymbol = false);
+void decompress_canonical(std::ostream &outputFile, std::istream &inputFile,
+                          const std::vector<unsigned char> &lengths,
+                          int remainder, bool multiSymbol = false);
+unsigned char decode_symbol(BitReader &stream, const DecodeTable &table);
+size_t decode_rounds_avx2(std::vector<BitReader> &streams,
+                          unsigned char *output, size_t count,
+                          const DecodeTable &table);
+void decode_rounds(std::vector<BitReader> &streams, unsigned char *output,
+                   size_t count, const DecodeTable &table);
+void decode_interleaved(OutputBuffer &output, std::istream &inputFile,
+                        const DecodeTable &table, const FileHeader &header);
+void decode_block(const unsigned char *payload, size_t payloadSize,
+                  unsigned char *output, size_t rawSize,
+                  const DecodeTable &table, int streams);
+void decode_file_block(const unsigned char *payload, size_t payloadSize,
+                       unsigned char *output, size_t rawSize,
+                       const DecodeTable &table, const FileHeader &header);
+void decode_blocks(int inputFd, int outputFd,
+                   const std::vector<BlockInfo> &blocks,
+                   const DecodeTable &table, const FileHeader &header,
+                   int threads);
+void decode_range(OutputBuffer &output, std::istream &inputFile,
+                  const DecodeTable &table,
+                  const std::vector<Checkpoint> &index, int remainder,
+                  long long end, unsigned long long first,
+                  unsigned long long length);
+void decode_blocks_range(OutputBuffer &output, std::istream &inputFile,
+                         const std::vector<BlockInfo> &blocks,
+                         const DecodeTable &table, const FileHeader &header,
+                         unsigned long long first, unsigned long long length);
+size_t encode_rounds_avx2(const unsigned char *data, size_t size,
+                          const EncodeTable &table, int streams,
+                          unsigned long long *pending, int *pendingBits,
+                          unsigned char **outputs);
+std::vector<std::vector<unsigned char>>
+encode_interleaved(const unsigned char *data, size_t size,
+                   const EncodeTable &table, int streams, bool simd = true);
+void encode_bytes(BitWriter &writer, const unsigned char *data, size_t size,
+                  const EncodeTable &table, const PairTable &pairs);
+std::vector<unsigned char>
+encode_block(const unsigned char *data, size_t size, const EncodeTable &table,
+             int streams, bool simd = true);
+std::vector<unsigned char>
+encode_block_with_table(const unsigned char *data, size_t size,
+                        BlockInfo &block, bool canonical, int streams,
+                        bool simd = true);
+void encode_blocks(std::istream &inputFile, std::ostream &outputFile,
+                   size_t blockSize, bool canonical, int streams, int threads,
+                   bool simd = true);
+void decompress(Node *head, std::ostream &outputFile, std::istream &inputFile,
+                int remainder, bool multiSymbol = false);
+void decompress_data(std::string file,
+                     const DecompressOptions &options = DecompressOptions());
+void check_compress_options(const CompressOptions &options);
+Histogram count_file_occurrences(const std::string &file,
+                                 const MappedFile &input,
+                                 const CompressOptions &options);
+Histogram get_file_occurrences(const std::string &file,
+                               const MappedFile &input,
+                               const CompressOptions &options);
+SizeEstimate
+estimate_compressed_size(std::string file,
+                         const CompressOptions &options = CompressOptions());
+void write_stored_file(std::ostream &outputFile, const std::string &extension,
+                       const unsigned char *data, size_t size);
+void write_compressed_file(const std::string &outputName,
+                           const std::string &extension,
+                           const unsigned char *data, size_t size,
+                           const Histogram &occurrences,
+                           const CompressOptions &options);
+void compress_data(std::string file,
+                   const CompressOptions &options = CompressOptions());
 
 #endif
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include "DecodeUtils.h"
+
+/**
+ * Recursively fills the decode table from a flat Huffman tree.
+ *
+ * This function walks the tree while tracking the code bits that lead to the
+ * current node. When it finds a leaf within tableBits of the root, every table
+ * slot whose leading bits match the leaf's code is set to the leaf's value and
+ * code length, so a single lookup on the next tableBits of input resolves the
+ * symbol no matter what bits follow it. When the walk reaches tableBits
+ * without finding a leaf, the slot instead stores the node reached so the
+ * decoder can finish the code bit by bit.
+ *
+ * @param tree The flat tree being walked.
+ * @param current The child reference of the node currently being visited.
+ * @param code The bits of the path taken from the root to current.
+ * @param depth The number of bits in code.
+ * @param tableBits The number of bits the table is indexed by.
+ * @param table The table being filled, sized 2^tableBits.
+ */
+void fill_decode_table(const FlatTree &tree, unsigned short current,
+                       unsigned int code, int depth, int tableBits,
+                       std::vector<DecodeEntry> &table) {
+  if (current == FLAT_EMPTY) {
+    return;
+  }
+
+  if (current & FLAT_LEAF) {
+    // Every slot starting with this code resolves to this leaf
+    int spare = tableBits - depth;
+    unsigned int first = code << spare;
+    unsigned int count = 1u << spare;
+    for (unsigned int i = 0; i < count; i++) {
+      table[first + i].symbol = static_cast<unsigned char>(current & 0xFF);
+      table[first + i].length = static_cast<unsigned char>(depth);
+    }
+    return;
+  }
+
+  if (depth == tableBits) {
+    // The code is longer than the table, remember where the walk continues
+    table[code].subtree = current;
+    return;
+  }
+
+  fill_decode_table(tree, tree.children[2 * current], code << 1, depth + 1,
+                    tableBits, table);
+  fill_decode_table(tree, tree.children[2 * current + 1], (code << 1) | 1,
+                    depth + 1, tableBits, table);
+}
+
+/**
+ * Builds a lookup table for decoding several bits of a Huffman code at once.
+ *
+ * The table has 2^tableBits entries and is indexed by the next tableBits of
+ * the compressed stream (most significant bit first). Each entry gives the
+ * decoded byte together with the length of its code, so the decoder can
+ * resolve a whole symbol with a single lookup instead of following one tree
+ * link per bit. Codes longer than tableBits point back into the flat tree,
+ * which is kept in the returned table.
+ *
+ * @param tree The flat Huffman tree, as returned by flat_tree_from_packet.
+ * @param tableBits The number of bits to peek per lookup.
+ * @return The decode table.
+ * @throws std::invalid_argument If the tree is empty or the table size is out
+ * of range.
+ */
+DecodeTable build_decode_table(const FlatTree &tree, int tableBits) {
+  if (tree.children.empty()) {
+    throw std::invalid_argument("Invalid Huffman tree, tree is empty.");
+  }
+
+  if (tableBits < 1 || tableBits > 16) {
+    throw std::invalid_argument("Decode table size must be 1 to 16 bits.");
+  }
+
+  DecodeTable table;
+  table.tableBits = tableBits;
+  table.tree = tree;
+  table.entries.resize(static_cast<size_t>(1) << tableBits);
+  fill_decode_table(tree, 0, 0, 0, tableBits, table.entries);
+  add_packed_entries(table);
+  return table;
+}
+
+/**
+ * Builds a lookup table for decoding from a Huffman tree of nodes.
+ *
+ * The tree is packed and flattened first, so the table does not point into
+ * the nodes and can outlive them.
+ *
+ * @param head The root of the Huffman tree.
+ * @param tableBits The number of bits to peek per lookup.
+ * @return The decode table.
+ * @throws std::invalid_argument If the tree is empty, is a lone leaf or the
+ * table size is out of range.
+ */
+DecodeTable build_decode_table(Node *head, int tableBits) {
+  if (head == nullptr) {
+    throw std::invalid_argument("Invalid Huffman tree, head received is null.");
+  }
+
+  return build_decode_table(flat_tree_from_packet(get_tree_packet(head)),
+                            tableBits);
+}
+
+/**
+ * Builds a decode table for canonical Huffman codes from their code lengths.
+ *
+ * The codes are rebuilt with get_canonical_codes, so no tree is needed. Codes
+ * of up to tableBits bits are written into a lookup table exactly like
+ * build_decode_table does. For the longer codes the table also records, for
+ * every length, the first canonical code of that length, how many codes have
+ * that length and where their bytes start in the list of bytes sorted by code.
+ * Because canonical codes of one length are consecutive numbers, a code of
+ * length L is valid exactly when it is less than count[L] above firstCode[L].
+ *
+ * @param lengths A vector of 256 code lengths indexed by byte value.
+ * @param tableBits The number of bits to peek per lookup.
+ * @return The canonical decode table.
+ * @throws std::invalid_argument If no byte has a code, the lengths do not form
+ * a prefix code or the table size is out of range.
+ */
+DecodeTable build_canonical_table(const std::vector<unsigned char> &lengths,
+                                  int tableBits) {
+  if (tableBits < 1 || tableBits > 16) {
+    throw std::invalid_argument("Decode table size must be 1 to 16 bits.");
+  }
+
+  std::vector<unsigned long long> codes = get_canonical_codes(lengths);
+
+  DecodeTable table;
+  table.tableBits = tableBits;
+  table.canonical = true;
+  table.entries.resize(static_cast<size_t>(1) << tableBits);
+  table.firstCode.assign(MAX_CODE_LENGTH + 1, 0);
+  table.firstSymbol.assign(MAX_CODE_LENGTH + 1, 0);
+  table.count.assign(MAX_CODE_LENGTH + 1, 0);
+
+  for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+    for (int value = 0; value < 256; value++) {
+      if (lengths[value] != length) {
+        continue;
+      }
+
+      if (table.count[length] == 0) {
+        table.firstCode[length] = codes[value];
+        table.firstSymbol[length] = table.symbols.size();
+      }
+      table.count[length]++;
+      table.symbols.push_back(static_cast<unsigned char>(value));
+      table.maxLength = length;
+
+      if (length <= tableBits) {
+        // Every slot starting with this code resolves to this byte
+        int spare = tableBits - length;
+        unsigned int first = static_cast<unsigned int>(codes[value]) << spare;
+        unsigned int slots = 1u << spare;
+        for (unsigned int i = 0; i < slots; i++) {
+          table.entries[first + i].symbol = static_cast<unsigned char>(value);
+          table.entries[first + i].length = static_cast<unsigned char>(length);
+        }
+      }
+    }
+  }
+
+  if (table.symbols.empty()) {
+    throw std::invalid_argument("Code lengths contain no codes.");
+  }
+
+  add_packed_entries(table);
+  return table;
+}
+
+/**
+ * Builds a decode table from a code table as stored in an hcmp file.
+ *
+ * The table is built straight from the stored code table, without allocating
+ * a node per tree entry.
+ *
+ * @param codeTable The tree packet or, for canonical codes, the 256 code
+ * lengths.
+ * @param canonical Whether the code table holds canonical code lengths.
+ * @param tableBits The number of bits to peek per lookup.
+ * @return The decode table.
+ * @throws std::invalid_argument If the code table is invalid.
+ */
+DecodeTable build_code_table(const std::vector<unsigned char> &codeTable,
+                             bool canonical, int tableBits) {
+  if (canonical) {
+    return build_canonical_table(codeTable, tableBits);
+  }
+  return build_decode_table(flat_tree_from_packet(codeTable), tableBits);
+}
+
+/**
+ * Fills in the multi-symbol table of a decode table.
+ *
+ * For every possible value of the peeked bits, this function decodes as many
+ * whole codes as fit in them (up to MULTI_SYMBOLS) using the single symbol
+ * entries, and stores the bytes together with the total number of bits they
+ * use. A code only counts if it ends within the peeked bits, so the bytes of
+ * an entry never depend on bits past the end of the lookup. On skewed inputs
+ * where the common bytes have codes of 2 to 4 bits, one lookup then produces
+ * two or three bytes.
+ *
+ * @param table The decode table to add the multi-symbol entries to.
+ */
+void add_multi_symbol_entries(DecodeTable &table) {
+  unsigned int size = 1u << table.tableBits;
+  unsigned int mask = size - 1;
+  table.multi.assign(size, MultiEntry());
+
+  for (unsigned int index = 0; index < size; index++) {
+    MultiEntry &multi = table.multi[index];
+    int used = 0;
+
+    while (multi.count < MULTI_SYMBOLS) {
+      // Look up the code starting after the bits already used
+      const DecodeEntry &entry = table.entries[(index << used) & mask];
+      if (entry.length == 0 || used + entry.length > table.tableBits) {
+        break;
+      }
+      multi.symbols[multi.count++] = entry.symbol;
+      used += entry.length;
+    }
+    multi.length = static_cast<unsigned char>(used);
+  }
+}
+
+/**
+ * Fills in the packed copy of the entries of a decode table.
+ *
+ * Each entry is stored as its byte in the low 8 bits and its code length in
+ * the next 8, so a SIMD gather can fetch the entries of several lookups at
+ * once. Codes longer than the table keep a length of 0.
+ *
+ * @param table The decode table to add the packed entries to.
+ */
+void add_packed_entries(DecodeTable &table) {
+  table.packed.resize(table.entries.size());
+  for (size_t i = 0; i < table.entries.size(); i++) {
+    table.packed[i] = table.entries[i].symbol | table.entries[i].length << 8;
+  }
+}
+
+/**
+ * Decodes a code that is longer than the decode table.
+ *
+ * For tables built from a tree, the walk continues one bit at a time through
+ * the flat tree from the subtree stored in the entry. For canonical tables,
+ * each longer length is tried in turn until the next bits fall within the
+ * range of codes of that length.
+ *
+ * @param table The decode table the entry came from.
+ * @param entry The entry found for the next tableBits bits.
+ * @param window The bits waiting to be decoded, the oldest bit is the most
+ * significant of the lowest windowBits bits.
+ * @param windowBits The number of valid bits in window.
+ * @param value Set to the decoded byte.
+ * @param length Set to the length of the decoded code.
+ * @return Whether a valid code was found within the window.
+ */
+bool decode_long_code(const DecodeTable &table, const DecodeEntry &entry,
+                      unsigned long long window, int windowBits,
+                      unsigned char &value, int &length) {
+  if (table.canonical) {
+    for (int i = table.tableBits + 1; i <= table.maxLength && i <= windowBits;
+         i++) {
+      unsigned long long code = (window >> (windowBits - i)) &
+                                ((1ULL << i) - 1);
+      unsigned long long offset = code - table.firstCode[i];
+      if (offset < static_cast<unsigned long long>(table.count[i])) {
+        value = table.symbols[table.firstSymbol[i] + offset];
+        length = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  unsigned short current = entry.subtree;
+  length = table.tableBits;
+  while (!(current & FLAT_LEAF)) {
+    if (length >= windowBits) {
+      return false;
+    }
+    int bit = (window >> (windowBits - length - 1)) & 1;
+    current = table.tree.children[2 * current + bit];
+    length++;
+  }
+
+  if (current == FLAT_EMPTY) {
+    return false;
+  }
+  value = static_cast<unsigned char>(current & 0xFF);
+  return true;
+}
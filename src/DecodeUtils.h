@@ -0,0 +1,77 @@
+#ifndef DECODE_UTILS_H
+#define DECODE_UTILS_H
+
+#include "Node.h"
+#include "TreeUtils.h"
+#include <stdexcept>
+#include <vector>
+
+// Number of bits peeked per lookup by the table driven decoder
+const int DECODE_TABLE_BITS = 11;
+
+// Number of bits peeked per lookup when decoding several bytes per lookup
+const int MULTI_TABLE_BITS = 12;
+
+// Most bytes a single multi-symbol lookup can produce
+const int MULTI_SYMBOLS = 4;
+
+// A single slot of the decode table. A length of 0 marks a code that is longer
+// than the table. For tables built from a tree, subtree then holds the flat
+// tree node reached after the peeked bits and decoding continues one bit at a
+// time from there.
+struct DecodeEntry {
+  unsigned char symbol = 0;
+  unsigned char length = 0;
+  unsigned short subtree = FLAT_EMPTY;
+};
+
+// A slot of the multi-symbol table, holding every whole code that fits in the
+// peeked bits. A count of 0 means the first code is longer than the table.
+struct MultiEntry {
+  unsigned char symbols[MULTI_SYMBOLS] = {0};
+  unsigned char count = 0;
+  unsigned char length = 0;
+};
+
+// Everything the table driven decoders need to decode a bitstream. Codes that
+// fit in the table are resolved with one lookup in entries. Longer codes
+// follow the entry's subtree in the flat tree, or for canonical tables are
+// found by comparing against the first canonical code of each length. The
+// multi-symbol table is only filled in by add_multi_symbol_entries. The
+// packed entries hold every entry as symbol | length << 8 in one 32 bit word,
+// which the AVX2 decoder gathers eight at a time unless simd is cleared.
+struct DecodeTable {
+  int tableBits = DECODE_TABLE_BITS;
+  std::vector<DecodeEntry> entries;
+  std::vector<MultiEntry> multi;
+  std::vector<unsigned int> packed;
+  bool simd = true;
+
+  FlatTree tree;
+
+  bool canonical = false;
+  std::vector<unsigned char> symbols;
+  std::vector<unsigned long long> firstCode;
+  std::vector<int> firstSymbol;
+  std::vector<int> count;
+  int maxLength = 0;
+};
+
+void fill_decode_table(const FlatTree &tree, unsigned short current,
+                       unsigned int code, int depth, int tableBits,
+                       std::vector<DecodeEntry> &table);
+DecodeTable build_decode_table(const FlatTree &tree,
+                               int tableBits = DECODE_TABLE_BITS);
+DecodeTable build_decode_table(Node *head, int tableBits = DECODE_TABLE_BITS);
+DecodeTable build_canonical_table(const std::vector<unsigned char> &lengths,
+                                  int tableBits = DECODE_TABLE_BITS);
+DecodeTable build_code_table(const std::vector<unsigned char> &codeTable,
+                             bool canonical,
+                             int tableBits = DECODE_TABLE_BITS);
+void add_multi_symbol_entries(DecodeTable &table);
+void add_packed_entries(DecodeTable &table);
+bool decode_long_code(const DecodeTable &table, const DecodeEntry &entry,
+                      unsigned long long window, int windowBits,
+                      unsigned char &value, int &length);
+
+#endif
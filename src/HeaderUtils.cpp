@@ -0,0 +1,342 @@
+#include "HeaderUtils.h"
+
+/**
+ * Writes the header of an hcmp file.
+ *
+ * The header starts with the HCMP magic, the format version and the flags,
+ * followed by the remainder, the original file extension and the code table
+ * (a tree packet or, with FLAG_CANONICAL, 256 code lengths). With
+ * FLAG_INTERLEAVED it ends with the number of sub-streams and, unless the file
+ * is split into blocks, the number of bytes in the original file and a jump
+ * table of sub-stream sizes. With FLAG_BLOCKS the block size comes last. Sizes
+ * are stored as 4 big-endian bytes using int_to_bytes, except for the count
+ * and sub-stream sizes of an interleaved file, which take 8 bytes so that
+ * files over 4 GB can be split into sub-streams.
+ *
+ * @param outputFile The file the header is written to.
+ * @param header The header to write.
+ */
+void write_header(std::ostream &outputFile, const FileHeader &header) {
+  outputFile.write(HCMP_MAGIC, sizeof(HCMP_MAGIC));
+  outputFile.put(static_cast<char>(header.version));
+  outputFile.put(static_cast<char>(header.flags));
+  outputFile.put(static_cast<char>(header.remainder));
+
+  write_size(outputFile, header.extension.size());
+  outputFile.write(header.extension.c_str(), header.extension.size());
+
+  write_size(outputFile, header.codeTable.size());
+  outputFile.write(reinterpret_cast<const char *>(header.codeTable.data()),
+                   header.codeTable.size());
+
+  if (header.flags & FLAG_INTERLEAVED) {
+    outputFile.put(static_cast<char>(header.streams));
+    if (!(header.flags & FLAG_BLOCKS)) {
+      write_offset(outputFile, header.symbolCount);
+      for (long long size : header.streamSizes) {
+        write_offset(outputFile, size);
+      }
+    }
+  }
+
+  if (header.flags & FLAG_BLOCKS) {
+    write_size(outputFile, header.blockSize);
+  }
+}
+
+/**
+ * Writes a size as 4 big-endian bytes.
+ *
+ * @param outputFile The file to write to.
+ * @param size The size to write.
+ */
+void write_size(std::ostream &outputFile, int size) {
+  std::vector<unsigned char> bytes = int_to_bytes(size);
+  outputFile.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+/**
+ * Reads a 4 byte big-endian size written by write_header.
+ *
+ * @param inputFile The file to read from.
+ * @return The size read.
+ * @throws std::runtime_error If the file ends before the size.
+ */
+int read_size(std::istream &inputFile) {
+  std::vector<unsigned char> bytes(4);
+  if (!inputFile.read(reinterpret_cast<char *>(bytes.data()), bytes.size())) {
+    throw std::runtime_error("Unexpected end of file in header.");
+  }
+  return byte_to_int(bytes);
+}
+
+/**
+ * Reads the header of an hcmp file, leaving the file at the compressed data.
+ *
+ * Files written before the format was versioned have no magic and start with
+ * the remainder as a native 4 byte integer, followed by native integer sizes
+ * for the extension and the tree packet. These are read as version
+ * HCMP_LEGACY_VERSION.
+ *
+ * @param inputFile The hcmp file to read from.
+ * @return The header of the file.
+ * @throws std::runtime_error If the header is truncated, holds flags that
+ * cannot be used together, a negative symbol count or sub-stream size or is
+ * from a newer version of the format.
+ */
+FileHeader read_header(std::istream &inputFile) {
+  FileHeader header;
+  char start[4];
+  if (!inputFile.read(start, sizeof(start))) {
+    throw std::runtime_error("Unexpected end of file in header.");
+  }
+
+  if (std::memcmp(start, HCMP_MAGIC, sizeof(HCMP_MAGIC)) != 0) {
+    header.version = HCMP_LEGACY_VERSION;
+    std::memcpy(&header.remainder, start, sizeof(header.remainder));
+
+    int extensionSize;
+    inputFile.read(reinterpret_cast<char *>(&extensionSize),
+                   sizeof(extensionSize));
+    header.extension.resize(extensionSize);
+    inputFile.read(&header.extension[0], extensionSize);
+
+    int treeSize;
+    inputFile.read(reinterpret_cast<char *>(&treeSize), sizeof(treeSize));
+    header.codeTable.resize(treeSize);
+    inputFile.read(reinterpret_cast<char *>(header.codeTable.data()),
+                   treeSize);
+
+    if (!inputFile) {
+      throw std::runtime_error("Unexpected end of file in header.");
+    }
+    return header;
+  }
+
+  header.version = static_cast<unsigned char>(inputFile.get());
+  header.flags = static_cast<unsigned char>(inputFile.get());
+  header.remainder = inputFile.get();
+  if (!inputFile) {
+    throw std::runtime_error("Unexpected end of file in header.");
+  }
+
+  if (header.version > HCMP_VERSION) {
+    throw std::runtime_error("Unsupported hcmp version, file is too new.");
+  }
+
+  // Per-block code tables only exist in a file of blocks, and a seek index
+  // only in a single unblocked stream
+  if (((header.flags & FLAG_BLOCK_TABLES) && !(header.flags & FLAG_BLOCKS)) ||
+      ((header.flags & FLAG_INDEX) &&
+       (header.flags & (FLAG_INTERLEAVED | FLAG_BLOCKS)))) {
+    throw std::runtime_error("Invalid combination of flags in header.");
+  }
+
+  header.extension.resize(read_size(inputFile));
+  inputFile.read(&header.extension[0], header.extension.size());
+
+  header.codeTable.resize(read_size(inputFile));
+  inputFile.read(reinterpret_cast<char *>(header.codeTable.data()),
+                 header.codeTable.size());
+
+  if (header.flags & FLAG_INTERLEAVED) {
+    header.streams = inputFile.get();
+    if (!inputFile || header.streams < 1 || header.streams > MAX_STREAMS) {
+      throw std::runtime_error("Invalid number of sub-streams in header.");
+    }
+    if (!(header.flags & FLAG_BLOCKS)) {
+      header.symbolCount = read_offset(inputFile);
+      for (int i = 0; i < header.streams - 1; i++) {
+        header.streamSizes.push_back(read_offset(inputFile));
+      }
+      if (header.symbolCount < 0) {
+        throw std::runtime_error("Invalid symbol count in header.");
+      }
+      for (long long size : header.streamSizes) {
+        if (size < 0) {
+          throw std::runtime_error("Invalid sub-stream size in header.");
+        }
+      }
+    }
+  }
+
+  if (header.flags & FLAG_BLOCKS) {
+    header.blockSize = read_size(inputFile);
+  }
+
+  if (!inputFile) {
+    throw std::runtime_error("Unexpected end of file in header.");
+  }
+  return header;
+}
+
+/**
+ * Writes the header in front of a block.
+ *
+ * @param outputFile The file the block header is written to.
+ * @param block The block's type, raw size and payload size.
+ */
+void write_block_header(std::ostream &outputFile, const BlockInfo &block) {
+  outputFile.put(static_cast<char>(block.type));
+  write_size(outputFile, block.rawSize);
+  write_size(outputFile, block.payloadSize);
+}
+
+/**
+ * Finds every block of a file split into blocks.
+ *
+ * Starting at the first block, this function reads each block header and
+ * seeks past the payload to the next one, recording where every payload is in
+ * the hcmp file and where its bytes go in the original file. Only the block
+ * headers are read, so this is cheap even for very large files, and the
+ * blocks can then be decoded in any order.
+ *
+ * @param inputFile The hcmp file, positioned at the first block header.
+ * @return The blocks in file order.
+ * @throws std::runtime_error If a block header is invalid, a stored block's
+ * payload is not its raw size or a payload runs past the end of the file.
+ */
+std::vector<BlockInfo> read_block_table(std::istream &inputFile) {
+  std::streampos start = inputFile.tellg();
+  inputFile.seekg(0, std::ios::end);
+  long long end = inputFile.tellg();
+  inputFile.seekg(start);
+
+  std::vector<BlockInfo> blocks;
+  long long position = start;
+  long long outputOffset = 0;
+
+  while (position < end) {
+    if (end - position < BLOCK_HEADER_SIZE) {
+      throw std::runtime_error("Unexpected end of file in block header.");
+    }
+
+    BlockInfo block;
+    block.type = static_cast<unsigned char>(inputFile.get());
+    block.rawSize = read_size(inputFile);
+    block.payloadSize = read_size(inputFile);
+    block.payloadOffset = position + BLOCK_HEADER_SIZE;
+    block.outputOffset = outputOffset;
+
+    if (block.rawSize < 0 || block.payloadSize < 0) {
+      throw std::runtime_error("Invalid block size.");
+    }
+    if (block.type != BLOCK_HUFFMAN && block.type != BLOCK_STORED) {
+      throw std::runtime_error("Unknown block type.");
+    }
+    if (block.type == BLOCK_STORED && block.payloadSize != block.rawSize) {
+      throw std::runtime_error("Stored block size does not match its data.");
+    }
+    if (block.payloadSize > end - block.payloadOffset) {
+      throw std::runtime_error("Block runs past the end of the file.");
+    }
+
+    blocks.push_back(block);
+    position = block.payloadOffset + block.payloadSize;
+    outputOffset += block.rawSize;
+    inputFile.seekg(position);
+  }
+
+  return blocks;
+}
+
+/**
+ * Writes an offset as 8 big-endian bytes.
+ *
+ * @param outputFile The file to write to.
+ * @param offset The offset to write.
+ */
+void write_offset(std::ostream &outputFile, unsigned long long offset) {
+  unsigned char bytes[8];
+  for (int i = 7; i >= 0; i--) {
+    bytes[i] = static_cast<unsigned char>(offset & 0xFF);
+    offset >>= 8;
+  }
+  outputFile.write(reinterpret_cast<const char *>(bytes), sizeof(bytes));
+}
+
+/**
+ * Reads an 8 byte big-endian offset written by write_offset.
+ *
+ * @param inputFile The file to read from.
+ * @return The offset read.
+ * @throws std::runtime_error If the file ends before the offset.
+ */
+unsigned long long read_offset(std::istream &inputFile) {
+  unsigned char bytes[8];
+  if (!inputFile.read(reinterpret_cast<char *>(bytes), sizeof(bytes))) {
+    throw std::runtime_error("Unexpected end of file in seek index.");
+  }
+  return load_big_endian_64(bytes);
+}
+
+/**
+ * Writes the seek index at the end of an hcmp file.
+ *
+ * Every checkpoint is stored as its offset in the original file followed by
+ * its offset in bits in the bitstream, and the number of checkpoints comes
+ * last so the index can be found from the end of the file.
+ *
+ * @param outputFile The file to write to, positioned after the bitstream.
+ * @param index The checkpoints in order of their offset.
+ */
+void write_seek_index(std::ostream &outputFile,
+                      const std::vector<Checkpoint> &index) {
+  for (const Checkpoint &checkpoint : index) {
+    write_offset(outputFile, checkpoint.outputOffset);
+    write_offset(outputFile, checkpoint.bitOffset);
+  }
+  write_offset(outputFile, index.size());
+}
+
+/**
+ * Reads the seek index from the end of an hcmp file.
+ *
+ * The file is left where it was, so this can be called right after
+ * read_header.
+ *
+ * @param inputFile The hcmp file, positioned at the start of the bitstream.
+ * @param dataEnd Set to the offset in the file where the bitstream ends and
+ * the index starts.
+ * @return The checkpoints in order of their offset.
+ * @throws std::runtime_error If the index does not fit in the file or its
+ * checkpoints are out of order.
+ */
+std::vector<Checkpoint> read_seek_index(std::istream &inputFile,
+                                        long long &dataEnd) {
+  std::streampos start = inputFile.tellg();
+  inputFile.seekg(0, std::ios::end);
+  long long end = inputFile.tellg();
+  if (end - start < 8) {
+    throw std::runtime_error("Unexpected end of file in seek index.");
+  }
+
+  inputFile.seekg(end - 8);
+  unsigned long long count = read_offset(inputFile);
+  if (count > static_cast<unsigned long long>(end - start - 8) / 16) {
+    throw std::runtime_error("Seek index is larger than the file.");
+  }
+  dataEnd = end - 8 - static_cast<long long>(count) * 16;
+
+  inputFile.seekg(dataEnd);
+  std::vector<Checkpoint> index(count);
+  for (Checkpoint &checkpoint : index) {
+    checkpoint.outputOffset = read_offset(inputFile);
+    checkpoint.bitOffset = read_offset(inputFile);
+  }
+
+  for (size_t i = 1; i < index.size(); i++) {
+    if (index[i].outputOffset < index[i - 1].outputOffset ||
+        index[i].bitOffset < index[i - 1].bitOffset) {
+      throw std::runtime_error("Seek index is out of order.");
+    }
+  }
+  unsigned long long dataBits =
+      static_cast<unsigned long long>(dataEnd - start) * 8;
+  if (!index.empty() && index.back().bitOffset > dataBits) {
+    throw std::runtime_error("Seek index points past the bitstream.");
+  }
+
+  inputFile.seekg(start);
+  return index;
+}
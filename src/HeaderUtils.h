@@ -0,0 +1,106 @@
+#ifndef HEADER_UTILS_H
+#define HEADER_UTILS_H
+
+#include "BitUtils.h"
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Every hcmp file written since the format was versioned starts with this
+const char HCMP_MAGIC[4] = {'H', 'C', 'M', 'P'};
+
+// Version 0 is the original unversioned layout, which is still readable
+const unsigned char HCMP_LEGACY_VERSION = 0;
+const unsigned char HCMP_VERSION = 1;
+
+// Offset of the remainder in a versioned header, after the magic, version and
+// flags, so it can be corrected once the data has been written
+const int REMAINDER_OFFSET = 6;
+
+// The code table holds 256 canonical code lengths instead of a tree packet
+const unsigned char FLAG_CANONICAL = 0x01;
+
+// The data is split round-robin over several separately packed sub-streams
+const unsigned char FLAG_INTERLEAVED = 0x02;
+
+// The data is a series of independently coded blocks, each with its own
+// block header, which all share the code table in the file header
+const unsigned char FLAG_BLOCKS = 0x04;
+
+// A seek index of checkpoints follows the bitstream at the end of the file
+const unsigned char FLAG_INDEX = 0x08;
+
+// Every block starts with a code table of its own, built from just the bytes
+// of that block, and the header's code table is empty
+const unsigned char FLAG_BLOCK_TABLES = 0x10;
+
+// Most sub-streams an interleaved file can be split into
+const int MAX_STREAMS = 8;
+
+// Block types, a Huffman block holds the coded bytes of its part of the file
+// and a stored block holds the bytes themselves, for data coding would not
+// make smaller
+const unsigned char BLOCK_STORED = 0;
+const unsigned char BLOCK_HUFFMAN = 1;
+
+// Size of the type, raw size and payload size in front of every block
+const int BLOCK_HEADER_SIZE = 9;
+
+// Largest block size, so a block's coded size always fits in its header
+const int MAX_BLOCK_SIZE = 1 << 28;
+
+// Everything stored in front of the compressed data of an hcmp file
+struct FileHeader {
+  unsigned char version = HCMP_VERSION;
+  unsigned char flags = 0;
+  int remainder = 0;
+  std::string extension;
+  std::vector<unsigned char> codeTable;
+
+  // Only stored with FLAG_INTERLEAVED. streamSizes holds the size in bytes of
+  // every sub-stream but the last, which runs to the end of the file. With
+  // FLAG_BLOCKS the sizes are instead stored at the start of every block.
+  int streams = 1;
+  long long symbolCount = 0;
+  std::vector<long long> streamSizes;
+
+  // Only stored with FLAG_BLOCKS, the number of original bytes in every block
+  // but the last
+  int blockSize = 0;
+};
+
+// Where a block is and what it holds, as found by read_block_table
+struct BlockInfo {
+  unsigned char type = BLOCK_HUFFMAN;
+  int rawSize = 0;
+  int payloadSize = 0;
+
+  // Offset of the payload in the hcmp file and of the block's bytes in the
+  // original file
+  long long payloadOffset = 0;
+  long long outputOffset = 0;
+};
+
+// A point the bitstream can be decoded from, the byte of the original file at
+// outputOffset has its code start bitOffset bits into the bitstream
+struct Checkpoint {
+  unsigned long long outputOffset = 0;
+  unsigned long long bitOffset = 0;
+};
+
+void write_header(std::ostream &outputFile, const FileHeader &header);
+void write_size(std::ostream &outputFile, int size);
+int read_size(std::istream &inputFile);
+FileHeader read_header(std::istream &inputFile);
+void write_block_header(std::ostream &outputFile, const BlockInfo &block);
+std::vector<BlockInfo> read_block_table(std::istream &inputFile);
+void write_offset(std::ostream &outputFile, unsigned long long offset);
+unsigned long long read_offset(std::istream &inputFile);
+void write_seek_index(std::ostream &outputFile,
+                      const std::vector<Checkpoint> &index);
+std::vector<Checkpoint> read_seek_index(std::istream &inputFile,
+                                        long long &dataEnd);
+
+#endif
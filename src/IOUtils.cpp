@@ -0,0 +1,314 @@
+#include "IOUtils.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * Creates an output buffer that writes to a stream.
+ *
+ * @param output The stream the buffered bytes are written to.
+ * @param capacity The size of the buffer in bytes, at least MIN_OUTPUT_BUFFER.
+ */
+OutputBuffer::OutputBuffer(std::ostream &output, size_t capacity)
+    : output(&output),
+      buffer(capacity < MIN_OUTPUT_BUFFER ? MIN_OUTPUT_BUFFER : capacity) {}
+
+/**
+ * Creates an output buffer that writes to a file descriptor with writev.
+ *
+ * @param fd The open file descriptor the buffered bytes are written to.
+ * @param capacity The size of the buffer in bytes, at least MIN_OUTPUT_BUFFER.
+ */
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+    : fd(fd),
+      buffer(capacity < MIN_OUTPUT_BUFFER ? MIN_OUTPUT_BUFFER : capacity) {}
+
+/**
+ * Flushes whatever is left in the buffer. Errors cannot be reported from a
+ * destructor, so callers should flush explicitly to see them.
+ */
+OutputBuffer::~OutputBuffer() {
+  try {
+    flush();
+  } catch (const std::exception &) {
+  }
+}
+
+/**
+ * Writes the buffered bytes to the output and empties the buffer.
+ *
+ * @throws std::runtime_error If the output cannot be written.
+ */
+void OutputBuffer::flush() {
+  if (used == 0) {
+    return;
+  }
+
+  if (output != nullptr) {
+    output->write(reinterpret_cast<const char *>(buffer.data()), used);
+    if (!*output) {
+      throw std::runtime_error("Failed to write the output file.");
+    }
+  } else {
+    write_fd(buffer.data(), used, nullptr, 0);
+  }
+  used = 0;
+}
+
+/**
+ * Writes a block too large for the free space in the buffer.
+ *
+ * With a file descriptor, the buffered bytes and the block go out together in
+ * a single writev call, so the block is never copied. A stream has no such
+ * call, so the buffer is flushed and the block written after it.
+ *
+ * @param data The bytes to write.
+ * @param count The number of bytes to write.
+ */
+void OutputBuffer::write_through(const unsigned char *data, size_t count) {
+  if (output != nullptr) {
+    flush();
+    output->write(reinterpret_cast<const char *>(data), count);
+    if (!*output) {
+      throw std::runtime_error("Failed to write the output file.");
+    }
+    return;
+  }
+
+  write_fd(buffer.data(), used, data, count);
+  used = 0;
+}
+
+/**
+ * Writes two blocks of bytes, one after the other, to the file descriptor.
+ *
+ * writev may write less than asked, so it is called until both blocks are
+ * fully written.
+ *
+ * @param first The first block.
+ * @param firstSize The number of bytes in the first block.
+ * @param second The second block, or nullptr.
+ * @param secondSize The number of bytes in the second block.
+ * @throws std::runtime_error If the file descriptor cannot be written.
+ */
+void OutputBuffer::write_fd(const unsigned char *first, size_t firstSize,
+                            const unsigned char *second, size_t secondSize) {
+  struct iovec parts[2];
+  parts[0].iov_base = const_cast<unsigned char *>(first);
+  parts[0].iov_len = firstSize;
+  parts[1].iov_base = const_cast<unsigned char *>(second);
+  parts[1].iov_len = secondSize;
+  struct iovec *part = parts;
+  int partCount = second != nullptr ? 2 : 1;
+
+  while (partCount > 0) {
+    ssize_t written = writev(fd, part, partCount);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to write the output file.");
+    }
+
+    // Skip whatever was written, which may end part way through a block
+    size_t done = written;
+    while (partCount > 0 && done >= part->iov_len) {
+      done -= part->iov_len;
+      part++;
+      partCount--;
+    }
+    if (partCount > 0) {
+      part->iov_base = static_cast<unsigned char *>(part->iov_base) + done;
+      part->iov_len -= done;
+    }
+  }
+}
+
+/**
+ * Maps a file into memory.
+ *
+ * Regular files are mapped whole and read-only, and the kernel is advised the
+ * mapping will be read sequentially so it reads ahead further. Anything that
+ * cannot be mapped, including pipes and files that report no size, is read
+ * into memory instead. An empty file has no bytes and a null data pointer.
+ *
+ * @param path The path of the file to map.
+ * @param populate Read every page of the file in while mapping it, rather than
+ * as each page is first touched.
+ * @throws std::runtime_error If the file cannot be opened or read.
+ */
+MappedFile::MappedFile(const std::string &path, bool populate) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open the file.");
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (populate) {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    void *address = mmap(nullptr, info.st_size, PROT_READ, flags, fd, 0);
+    if (address != MAP_FAILED) {
+      mapping = address;
+      bytes = static_cast<const unsigned char *>(address);
+      length = info.st_size;
+      madvise(mapping, length, MADV_SEQUENTIAL);
+      close(fd);
+      return;
+    }
+  }
+
+  // Read whatever could not be mapped until it runs out
+  size_t used = 0;
+  copy.resize(1 << 16);
+  while (true) {
+    if (used == copy.size()) {
+      copy.resize(copy.size() * 2);
+    }
+    ssize_t done = read(fd, copy.data() + used, copy.size() - used);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      throw std::runtime_error("Failed to read the input file.");
+    }
+    if (done == 0) {
+      break;
+    }
+    used += done;
+  }
+  close(fd);
+
+  copy.resize(used);
+  bytes = used > 0 ? copy.data() : nullptr;
+  length = used;
+}
+
+/**
+ * Unmaps the file, if it was mapped.
+ */
+MappedFile::~MappedFile() {
+  if (mapping != nullptr) {
+    munmap(mapping, length);
+  }
+}
+
+/**
+ * Reads bytes from a given offset of a file descriptor.
+ *
+ * This uses pread, which does not move the file offset, so several threads can
+ * read different parts of the same file at once. Short reads are retried until
+ * every byte has been read.
+ *
+ * @param fd The file descriptor to read from.
+ * @param data Where the bytes are stored.
+ * @param count The number of bytes to read.
+ * @param offset The offset in the file of the first byte.
+ * @throws std::runtime_error If the file cannot be read or ends too early.
+ */
+void read_at(int fd, unsigned char *data, size_t count, long long offset) {
+  while (count > 0) {
+    ssize_t done = pread(fd, data, count, offset);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to read the input file.");
+    }
+    if (done == 0) {
+      throw std::runtime_error("Unexpected end of the input file.");
+    }
+    data += done;
+    count -= done;
+    offset += done;
+  }
+}
+
+/**
+ * Writes bytes at a given offset of a file descriptor.
+ *
+ * This uses pwrite, so like read_at several threads can each write their own
+ * part of the same file at once. Short writes are retried until every byte has
+ * been written.
+ *
+ * @param fd The file descriptor to write to.
+ * @param data The bytes to write.
+ * @param count The number of bytes to write.
+ * @param offset The offset in the file of the first byte.
+ * @throws std::runtime_error If the file cannot be written.
+ */
+void write_at(int fd, const unsigned char *data, size_t count,
+              long long offset) {
+  while (count > 0) {
+    ssize_t done = pwrite(fd, data, count, offset);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to write the output file.");
+    }
+    data += done;
+    count -= done;
+    offset += done;
+  }
+}
+
+/**
+ * Copies bytes from one file descriptor to another at given offsets.
+ *
+ * On Linux this uses copy_file_range, so the kernel moves the bytes without
+ * them passing through user space, and filesystems that can share extents do
+ * not copy them at all. Where that is not supported the bytes are moved with
+ * read_at and write_at instead. Like those, neither file's offset is used, so
+ * several threads can copy parts of the same files at once.
+ *
+ * @param inputFd The file descriptor to read from.
+ * @param inputOffset The offset in the input file of the first byte.
+ * @param outputFd The file descriptor to write to.
+ * @param outputOffset The offset in the output file of the first byte.
+ * @param count The number of bytes to copy.
+ * @throws std::runtime_error If the input ends early or either file cannot be
+ * used.
+ */
+void copy_at(int inputFd, long long inputOffset, int outputFd,
+             long long outputOffset, size_t count) {
+#if defined(__linux__)
+  while (count > 0) {
+    loff_t from = inputOffset;
+    loff_t to = outputOffset;
+    ssize_t done = copy_file_range(inputFd, &from, outputFd, &to, count, 0);
+    if (done < 0 && errno == EINTR) {
+      continue;
+    }
+    if (done < 0) {
+      // Not supported for these files, copy the rest through a buffer
+      break;
+    }
+    if (done == 0) {
+      throw std::runtime_error("Unexpected end of the input file.");
+    }
+    inputOffset += done;
+    outputOffset += done;
+    count -= done;
+  }
+#endif
+
+  std::vector<unsigned char> buffer(std::min<size_t>(count, 1 << 20));
+  while (count > 0) {
+    size_t chunk = std::min(count, buffer.size());
+    read_at(inputFd, buffer.data(), chunk, inputOffset);
+    write_at(outputFd, buffer.data(), chunk, outputOffset);
+    inputOffset += chunk;
+    outputOffset += chunk;
+    count -= chunk;
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef IO_UTILS_H
+#define IO_UTILS_H
+
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Default and smallest sizes of the decompression output buffer
+const size_t DEFAULT_OUTPUT_BUFFER = 1 << 20;
+const size_t MIN_OUTPUT_BUFFER = 1 << 12;
+
+// Collects decoded bytes in one large buffer and hands them to the output in
+// big chunks. The output is either a stream or, to allow writev, a file
+// descriptor. Anything left in the buffer is written by flush, which the
+// destructor also calls as a last resort.
+class OutputBuffer {
+public:
+  explicit OutputBuffer(std::ostream &output,
+                        size_t capacity = DEFAULT_OUTPUT_BUFFER);
+  explicit OutputBuffer(int fd, size_t capacity = DEFAULT_OUTPUT_BUFFER);
+  ~OutputBuffer();
+
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  // Adds one byte
+  void put(unsigned char byte) {
+    if (used == buffer.size()) {
+      flush();
+    }
+    buffer[used++] = byte;
+  }
+
+  // Adds count bytes, large writes skip the buffer
+  void write(const unsigned char *data, size_t count) {
+    if (count <= buffer.size() - used) {
+      std::memcpy(buffer.data() + used, data, count);
+      used += count;
+    } else {
+      write_through(data, count);
+    }
+  }
+
+  // Returns space for count bytes (at most capacity()) for the caller to fill
+  unsigned char *claim(size_t count) {
+    if (count > buffer.size() - used) {
+      flush();
+    }
+    unsigned char *space = buffer.data() + used;
+    used += count;
+    return space;
+  }
+
+  size_t capacity() const { return buffer.size(); }
+
+  void flush();
+
+private:
+  void write_through(const unsigned char *data, size_t count);
+  void write_fd(const unsigned char *first, size_t firstSize,
+                const unsigned char *second, size_t secondSize);
+
+  std::ostream *output = nullptr;
+  int fd = -1;
+  std::vector<unsigned char> buffer;
+  size_t used = 0;
+};
+
+// Maps a whole file read-only into memory, so it can be read any number of
+// times straight from the page cache without copying it. The kernel is told
+// the mapping is read front to back, and with populate every page is read in
+// when the file is mapped. Files that cannot be mapped, such as pipes, are
+// read into memory instead.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path, bool populate = false);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const unsigned char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+  // Whether the bytes are mapped rather than copied into memory
+  bool mapped() const { return mapping != nullptr; }
+
+private:
+  void *mapping = nullptr;
+  const unsigned char *bytes = nullptr;
+  size_t length = 0;
+  std::vector<unsigned char> copy;
+};
+
+void read_at(int fd, unsigned char *data, size_t count, long long offset);
+void write_at(int fd, const unsigned char *data, size_t count,
+              long long offset);
+void copy_at(int inputFd, long long inputOffset, int outputFd,
+             long long outputOffset, size_t count);
+
+#endif
@@ -1,84 +1,245 @@
 #include "MapUtils.h"
 
 /**
- * Converts a map of byte occurrences into a vector of nodes.
+ * Converts a histogram of byte occurrences into a vector of nodes.
  *
- * This function takes a map where the key is a byte value (unsigned char) and
- * the value is the frequency of that byte. It creates a new node for each entry
- * in the map, where the node's value is the byte and the node's frequency is
- * the frequency of the byte. These nodes are then added to a vector.
+ * This function takes a histogram holding the frequency of every byte value.
+ * It creates a new node for each byte that appears, in order of byte value,
+ * where the node's value is the byte and the node's frequency is the frequency
+ * of the byte. These nodes are then added to a vector.
  *
- * @param occurrences The map of byte occurrences to be converted into nodes.
+ * @param occurrences The histogram of byte occurrences to be converted into
+ * nodes.
  * @return A vector of nodes representing the byte occurrences.
  */
-std::vector<Node *>
-get_occurrence_nodes(std::map<unsigned char, int> &occurrences) {
+std::vector<Node *> get_occurrence_nodes(const Histogram &occurrences) {
   std::vector<Node *> nodes;
 
-  for (auto &touple : occurrences) {
-    nodes.push_back(new Node(touple.first, touple.second));
+  for (int value = 0; value < 256; value++) {
+    if (occurrences[value] > 0) {
+      nodes.push_back(new Node(value, occurrences[value]));
+    }
   }
 
   return nodes;
 }
 
 /**
- * Creates a map of byte occurrences in a file.
+ * Adds how many times each byte appears in a block of memory to a table of
+ * counts.
  *
- * This function reads the input file one byte at a time, converting each byte
- * to an unsigned char. It then increments the count of that byte in the
- * occurrences map. The function continues this process until it has read the
- * entire file.
+ * The bytes are read eight at a time and counted into four tables in turn, so
+ * a run of the same byte increments four different counters rather than
+ * having every increment wait on the one before it. The tables hold 32 bit
+ * counts to stay small in cache, and are added to the totals after every
+ * COUNT_PIECE_SIZE bytes.
  *
- * @param inputFile The file to be read.
- * @return A map where the key is a byte and the value is the frequency of that
- * byte in the file.
+ * @param data The bytes to count.
+ * @param size The number of bytes in data.
+ * @param counts The counts of every byte value, which the counts of data are
+ * added to.
  */
-std::map<unsigned char, int> get_occurrences(std::ifstream &inputFile) {
-  std::map<unsigned char, int> occurrences;
-  unsigned char byte;
+void count_bytes(const unsigned char *data, size_t size, Histogram &counts) {
+  std::array<std::array<uint32_t, 256>, 4> tables;
 
-  while (inputFile.read(reinterpret_cast<char *>(&byte), sizeof(byte))) {
-    occurrences[byte]++;
+  while (size > 0) {
+    size_t piece = std::min(size, COUNT_PIECE_SIZE);
+    for (auto &table : tables) {
+      table.fill(0);
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= piece; i += 8) {
+      uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      tables[0][word & 0xFF]++;
+      tables[1][(word >> 8) & 0xFF]++;
+      tables[2][(word >> 16) & 0xFF]++;
+      tables[3][(word >> 24) & 0xFF]++;
+      tables[0][(word >> 32) & 0xFF]++;
+      tables[1][(word >> 40) & 0xFF]++;
+      tables[2][(word >> 48) & 0xFF]++;
+      tables[3][word >> 56]++;
+    }
+    for (; i < piece; i++) {
+      tables[0][data[i]]++;
+    }
+
+    for (int value = 0; value < 256; value++) {
+      counts[value] += static_cast<unsigned long long>(tables[0][value]) +
+                       tables[1][value] + tables[2][value] + tables[3][value];
+    }
+    data += piece;
+    size -= piece;
+  }
+}
+
+/**
+ * Counts how many times each byte appears in a block of memory.
+ *
+ * With several threads the block is split into one equal part per thread and
+ * every thread counts its part into a table of its own, so the threads share
+ * nothing until the tables are added together once they have all finished.
+ * Every thread is given at least MIN_THREAD_COUNT_SIZE bytes, so small blocks
+ * use fewer threads.
+ *
+ * @param data The bytes to count.
+ * @param size The number of bytes in data.
+ * @param threads The number of threads to count with, 0 for one per hardware
+ * thread.
+ * @return A histogram of the number of times every byte value appears.
+ */
+Histogram get_occurrences(const unsigned char *data, size_t size,
+                          int threads) {
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<size_t>(
+      1, std::min<size_t>(threads, size / MIN_THREAD_COUNT_SIZE));
+
+  // The calling thread counts the first part while the others count the rest
+  std::vector<Histogram> tables(threads);
+  std::vector<std::thread> workers;
+  size_t part = size / threads;
+  for (int i = 1; i < threads; i++) {
+    size_t first = i * part;
+    size_t count = i == threads - 1 ? size - first : part;
+    workers.emplace_back([&tables, data, first, count, i]() {
+      tables[i].fill(0);
+      count_bytes(data + first, count, tables[i]);
+    });
+  }
+  tables[0].fill(0);
+  count_bytes(data, threads == 1 ? size : part, tables[0]);
+  for (auto &worker : workers) {
+    worker.join();
   }
 
+  Histogram occurrences = tables[0];
+  for (int i = 1; i < threads; i++) {
+    for (int value = 0; value < 256; value++) {
+      occurrences[value] += tables[i][value];
+    }
+  }
   return occurrences;
 }
 
 /**
- * Calculates the amount of padding needed for the final byte of the compressed
- * data.
+ * Counts the bytes of evenly spaced chunks making up part of a block of
+ * memory.
  *
- * This function uses the occurrences map and the look-up table to find the
- * exact length in bits the compressed data will be. It then mods this length by
- * 8 and subtracts the result from 8 to find the amount of bits that need to be
- * padded on the final byte.
+ * Enough chunks of SAMPLE_CHUNK_SIZE bytes to make up percent of the block
+ * are counted. A sample too small for MIN_SAMPLE_CHUNKS of them is split
+ * into that many smaller chunks instead, of at least MIN_SAMPLE_CHUNK_SIZE
+ * bytes. The block is divided into one stride per chunk and every chunk is
+ * read from the middle of its stride, so the sample reaches the end of the
+ * block as much as its start. Bytes outside the chunks may not have been
+ * seen, so every byte value is given a count of at least 1 and therefore a
+ * code. When the chunks would cover the whole block, every byte is counted
+ * as get_occurrences does instead.
  *
- * @param intMap The map of byte occurrences.
- * @param stringMap The look-up table mapping bytes to their Huffman codes.
- * @return The number of bits that need to be padded on the final byte.
+ * @param data The bytes to sample.
+ * @param size The number of bytes in data.
+ * @param percent The percentage of the bytes to count, above 0.
+ * @return A histogram of the number of times every byte value appears in the
+ * sample, at least 1.
  */
-int get_padding_amount(std::map<unsigned char, int> intMap,
-                       std::map<unsigned char, std::string> stringMap) {
-  int sum = 0;
+Histogram get_sampled_occurrences(const unsigned char *data, size_t size,
+                                  double percent) {
+  size_t target = static_cast<size_t>(size * (percent / 100));
+  size_t chunkSize = SAMPLE_CHUNK_SIZE;
+  size_t chunks = (target + chunkSize - 1) / chunkSize;
+  if (chunks < MIN_SAMPLE_CHUNKS) {
+    chunks = MIN_SAMPLE_CHUNKS;
+    chunkSize = std::max(MIN_SAMPLE_CHUNK_SIZE, (target + chunks - 1) / chunks);
+  }
+  if (percent >= 100 || chunks * chunkSize >= size) {
+    return get_occurrences(data, size);
+  }
+
+  Histogram occurrences{};
+  size_t stride = size / chunks;
+  size_t offset = (stride - chunkSize) / 2;
+  for (size_t i = 0; i < chunks; i++) {
+    count_bytes(data + i * stride + offset, chunkSize, occurrences);
+  }
+
+  for (auto &count : occurrences) {
+    count = std::max(count, 1ULL);
+  }
+  return occurrences;
+}
 
-  // Iterators that will traverse the maps
-  std::map<unsigned char, int>::iterator it1 = intMap.begin();
-  std::map<unsigned char, std::string>::iterator it2 = stringMap.begin();
+/**
+ * Calculates the length in bits of the compressed data.
+ *
+ * This multiplies how many times each byte appears by the length of its code,
+ * which gives exactly how many bits the codes of the whole file take up
+ * without encoding it.
+ *
+ * @param occurrences The histogram of byte occurrences.
+ * @param table The encode table holding the length of every byte's code.
+ * @return The number of bits the codes of every byte take up.
+ */
+unsigned long long get_coded_bits(const Histogram &occurrences,
+                                  const EncodeTable &table) {
+  unsigned long long sum = 0;
 
-  for (; it1 != intMap.end(); ++it1, ++it2) {
+  for (int value = 0; value < 256; value++) {
+    // Multiplying how many times a character appears by the length of its
+    // code to find exactly how many bits it will take up, and adding that to
+    // the total bit amount for the file
+    sum += occurrences[value] * table[value].length;
+  }
 
-    // Getting how many times a character appears
-    int intValue = it1->second;
+  return sum;
+}
 
-    // Getting how many binary characters are used to represnt that character
-    std::string stringValue = it2->second;
+/**
+ * Calculates the length in bits of the compressed data from counts that may
+ * cover only a sample of it.
+ *
+ * When the counts add up to size this is exactly get_coded_bits. Otherwise the
+ * bits of the counted bytes are scaled up to size bytes, which estimates the
+ * length for the whole of the data.
+ *
+ * @param occurrences The histogram of byte occurrences.
+ * @param table The encode table holding the length of every byte's code.
+ * @param size The number of bytes in the data.
+ * @return The number of bits the codes of every byte take up, or an estimate
+ * of it.
+ */
+unsigned long long get_scaled_coded_bits(const Histogram &occurrences,
+                                         const EncodeTable &table,
+                                         unsigned long long size) {
+  unsigned long long bits = get_coded_bits(occurrences, table);
+  unsigned long long counted = 0;
+  for (unsigned long long count : occurrences) {
+    counted += count;
+  }
 
-    // Multiplying them to find exactly how many bits a character will take up
-    // And adding that to the total bit amount for the file
-    int result = intValue * stringValue.size();
-    sum += result;
+  if (counted == size || counted == 0) {
+    return bits;
   }
+  return static_cast<unsigned long long>(static_cast<double>(bits) * size /
+                                         counted);
+}
+
+/**
+ * Calculates the amount of padding needed for the final byte of the compressed
+ * data.
+ *
+ * This function uses get_coded_bits to find the exact length in bits the
+ * compressed data will be. It then mods this length by 8 and subtracts the
+ * result from 8 to find the amount of bits that need to be padded on the final
+ * byte.
+ *
+ * @param occurrences The histogram of byte occurrences.
+ * @param table The encode table holding the length of every byte's code.
+ * @return The number of bits that need to be padded on the final byte.
+ */
+int get_padding_amount(const Histogram &occurrences, const EncodeTable &table) {
+  unsigned long long sum = get_coded_bits(occurrences, table);
 
   // Finding how many bits would be needed to pad out the last byte
   // i.e. how many bits shy of 8 are we
@@ -91,4 +252,171 @@ int get_padding_amount(std::map<unsigned char, int> intMap,
   }
 
   return remainder;
-}
\ No newline at end of file
+}
+
+/**
+ * Hashes a block of bytes with 64 bit FNV-1a.
+ *
+ * @param data The bytes to hash.
+ * @param size The number of bytes in data.
+ * @param hash The hash to continue from, so several blocks can be hashed as
+ * one. 0xcbf29ce484222325 to start a new hash.
+ * @return The hash of the bytes.
+ */
+unsigned long long hash_bytes(const unsigned char *data, size_t size,
+                              unsigned long long hash) {
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * Works out what identifies a file for the histogram cache.
+ *
+ * The device, inode, size and modification time come from the file system
+ * and the content hash from the first and last CACHE_HASH_SIZE bytes of the
+ * file, which the caller has already read or mapped.
+ *
+ * @param file The path to the file.
+ * @param data The bytes of the file.
+ * @param size The number of bytes in data.
+ * @return The key a histogram of the file is cached under.
+ * @throws std::runtime_error If the file cannot be found.
+ */
+HistogramKey get_histogram_key(const std::string &file,
+                               const unsigned char *data, size_t size) {
+  struct stat info;
+  if (stat(file.c_str(), &info) != 0) {
+    throw std::runtime_error("Failed to open the file.");
+  }
+
+  HistogramKey key;
+  key.device = info.st_dev;
+  key.inode = info.st_ino;
+  key.size = size;
+  key.modifiedSeconds = info.st_mtim.tv_sec;
+  key.modifiedNanoseconds = info.st_mtim.tv_nsec;
+
+  size_t head = std::min(size, CACHE_HASH_SIZE);
+  size_t tail = std::min(size - head, CACHE_HASH_SIZE);
+  key.contentHash = hash_bytes(data, head, 0xcbf29ce484222325ULL);
+  key.contentHash = hash_bytes(data + size - tail, tail, key.contentHash);
+  return key;
+}
+
+/**
+ * Works out where the cached histogram of a file is kept.
+ *
+ * There is one cache file per device and inode, so a file that changes
+ * replaces its old histogram rather than adding another.
+ *
+ * @param cacheDir The directory the histograms are cached in.
+ * @param key The key of the file.
+ * @return The path of the file's cached histogram.
+ */
+std::string get_histogram_cache_path(const std::string &cacheDir,
+                                     const HistogramKey &key) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "%llx-%llx.hist", key.device, key.inode);
+  return cacheDir + "/" + name;
+}
+
+/**
+ * Reads the cached histogram of a file, if it is still valid.
+ *
+ * The cache file must be complete, match every field of the key and hold
+ * counts adding up to the size of the file. Anything else, including there
+ * being no cache file, counts as a miss. Bytes between the blocks hashed for
+ * the key are not checked, so a hit may be stale and the caller must not
+ * leave any byte value without a code.
+ *
+ * @param cacheDir The directory the histograms are cached in.
+ * @param key The key of the file as it is now.
+ * @param occurrences Set to the cached histogram when it is valid.
+ * @return Whether a valid histogram was found.
+ */
+bool load_cached_histogram(const std::string &cacheDir,
+                           const HistogramKey &key, Histogram &occurrences) {
+  std::ifstream cacheFile(get_histogram_cache_path(cacheDir, key),
+                          std::ios::binary);
+  char magic[sizeof(HISTOGRAM_CACHE_MAGIC)];
+  if (!cacheFile.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, HISTOGRAM_CACHE_MAGIC, sizeof(magic)) != 0 ||
+      cacheFile.get() != HISTOGRAM_CACHE_VERSION) {
+    return false;
+  }
+
+  try {
+    if (read_offset(cacheFile) != key.device ||
+        read_offset(cacheFile) != key.inode ||
+        read_offset(cacheFile) != key.size ||
+        static_cast<long long>(read_offset(cacheFile)) !=
+            key.modifiedSeconds ||
+        static_cast<long long>(read_offset(cacheFile)) !=
+            key.modifiedNanoseconds ||
+        read_offset(cacheFile) != key.contentHash) {
+      return false;
+    }
+
+    Histogram cached;
+    unsigned long long total = 0;
+    for (auto &count : cached) {
+      count = read_offset(cacheFile);
+      total += count;
+    }
+    if (total != key.size) {
+      return false;
+    }
+    occurrences = cached;
+    return true;
+  } catch (const std::runtime_error &) {
+    return false;
+  }
+}
+
+/**
+ * Writes the histogram of a file to the cache.
+ *
+ * The cache directory is created if it does not exist. The histogram is
+ * written to a temporary file which is then renamed over the old one, so
+ * another process never reads a half written histogram.
+ *
+ * @param cacheDir The directory the histograms are cached in.
+ * @param key The key of the file the histogram was counted from.
+ * @param occurrences The histogram of the whole file.
+ * @throws std::runtime_error If the histogram cannot be written.
+ */
+void store_cached_histogram(const std::string &cacheDir,
+                            const HistogramKey &key,
+                            const Histogram &occurrences) {
+  if (mkdir(cacheDir.c_str(), 0777) != 0 && errno != EEXIST) {
+    throw std::runtime_error("Failed to create the cache directory.");
+  }
+
+  std::string path = get_histogram_cache_path(cacheDir, key);
+  std::string temporary = path + "." + std::to_string(getpid());
+  {
+    std::ofstream cacheFile(temporary, std::ios::binary);
+    cacheFile.write(HISTOGRAM_CACHE_MAGIC, sizeof(HISTOGRAM_CACHE_MAGIC));
+    cacheFile.put(static_cast<char>(HISTOGRAM_CACHE_VERSION));
+    write_offset(cacheFile, key.device);
+    write_offset(cacheFile, key.inode);
+    write_offset(cacheFile, key.size);
+    write_offset(cacheFile, key.modifiedSeconds);
+    write_offset(cacheFile, key.modifiedNanoseconds);
+    write_offset(cacheFile, key.contentHash);
+    for (unsigned long long count : occurrences) {
+      write_offset(cacheFile, count);
+    }
+    if (!cacheFile.flush()) {
+      std::remove(temporary.c_str());
+      throw std::runtime_error("Failed to write the cached histogram.");
+    }
+  }
+
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    throw std::runtime_error("Failed to write the cached histogram.");
+  }
+}
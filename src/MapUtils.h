@@ -1,16 +1,86 @@
 #ifndef MAP_UTILS_H
 #define MAP_UTILS_H
 
+#include "HeaderUtils.h"
 #include "Node.h"
+#include "TreeUtils.h"
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
-#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
-std::vector<Node *>
-get_occurrence_nodes(std::map<unsigned char, int> &occurrences);
-std::map<unsigned char, int> get_occurrences(std::ifstream &inputFile);
-int get_padding_amount(std::map<unsigned char, int> intMap,
-                       std::map<unsigned char, std::string> stringMap);
+// Number of times each byte value appears, indexed by the byte. Every byte
+// value has a slot, so counting never allocates and a histogram is copied as
+// one flat block.
+typedef std::array<unsigned long long, 256> Histogram;
+
+// Most bytes count_bytes counts into its 32 bit tables before adding them to
+// the totals, so that no table entry can overflow
+const size_t COUNT_PIECE_SIZE = 1 << 30;
+
+// Fewest bytes each thread counting a block of memory is given, smaller blocks
+// are counted on fewer threads
+const size_t MIN_THREAD_COUNT_SIZE = 1 << 22;
+
+// Number of bytes in each of the evenly spaced chunks a sampled count reads
+const size_t SAMPLE_CHUNK_SIZE = 1 << 16;
+
+// Fewest chunks a sampled count reads, so a small sample still reaches every
+// part of the data, and the smallest those chunks are cut down to
+const size_t MIN_SAMPLE_CHUNKS = 16;
+const size_t MIN_SAMPLE_CHUNK_SIZE = 1 << 12;
+
+// Every cached histogram file starts with this, followed by a version
+const char HISTOGRAM_CACHE_MAGIC[4] = {'H', 'C', 'H', 'S'};
+const unsigned char HISTOGRAM_CACHE_VERSION = 1;
+
+// Number of bytes at the start and at the end of a file that are hashed to
+// tell whether a cached histogram of it still holds
+const size_t CACHE_HASH_SIZE = 1 << 16;
+
+// What a cached histogram is checked against before it is used in place of
+// counting the file again. The file is found by its device and inode, and
+// its size, modification time and a hash of its first and last
+// CACHE_HASH_SIZE bytes must all be unchanged.
+struct HistogramKey {
+  unsigned long long device = 0;
+  unsigned long long inode = 0;
+  unsigned long long size = 0;
+  long long modifiedSeconds = 0;
+  long long modifiedNanoseconds = 0;
+  unsigned long long contentHash = 0;
+};
+
+std::vector<Node *> get_occurrence_nodes(const Histogram &occurrences);
+void count_bytes(const unsigned char *data, size_t size, Histogram &counts);
+Histogram get_occurrences(const unsigned char *data, size_t size,
+                          int threads = 1);
+Histogram get_sampled_occurrences(const unsigned char *data, size_t size,
+                                  double percent);
+unsigned long long get_coded_bits(const Histogram &occurrences,
+                                  const EncodeTable &table);
+unsigned long long get_scaled_coded_bits(const Histogram &occurrences,
+                                         const EncodeTable &table,
+                                         unsigned long long size);
+int get_padding_amount(const Histogram &occurrences, const EncodeTable &table);
+unsigned long long hash_bytes(const unsigned char *data, size_t size,
+                              unsigned long long hash);
+HistogramKey get_histogram_key(const std::string &file,
+                               const unsigned char *data, size_t size);
+std::string get_histogram_cache_path(const std::string &cacheDir,
+                                     const HistogramKey &key);
+bool load_cached_histogram(const std::string &cacheDir,
+                           const HistogramKey &key, Histogram &occurrences);
+void store_cached_histogram(const std::string &cacheDir,
+                            const HistogramKey &key,
+                            const Histogram &occurrences);
 
 #endif
\ No newline at end of file
@@ -3,7 +3,7 @@
 // Define constructors
 Node::Node() : value(0), frequency(0), left(nullptr), right(nullptr) {}
 
-Node::Node(char val, int freq)
+Node::Node(char val, unsigned long long freq)
     : value(val), frequency(freq), left(nullptr), right(nullptr) {}
 
 // Deconstructor frees all child nodes upon descruction of parent node
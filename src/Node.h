@@ -5,13 +5,13 @@
 class Node {
 public:
   unsigned char value;
-  int frequency;
+  unsigned long long frequency;
   Node *left = nullptr;
   Node *right = nullptr;
 
   Node();
 
-  Node(char val, int freq);
+  Node(char val, unsigned long long freq);
 
   // Deconstructor frees all child nodes upon descruction of parent node
   ~Node();
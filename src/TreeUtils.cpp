@@ -1,6 +1,6 @@
 #include "TreeUtils.h"
 
-const int MAX_INT = 2147483647;
+const unsigned long long MAX_FREQUENCY = ~0ULL;
 
 /**
  * Traverses a Huffman tree in pre-order form and packs the tree into a vector
@@ -26,8 +26,12 @@ void pre_order_packing(Node *head, std::vector<unsigned char> &tree) {
   // Second add the frequency
 
   // Convert the frequency integer into a vector of unsigned char
-  // Each item in the vector is once of 4 bytes that make up an integer
-  std::vector<unsigned char> frequency = int_to_bytes(head->frequency);
+  // Each item in the vector is once of 4 bytes that make up an integer. The
+  // decoder only uses the shape of the tree, so a frequency too large for an
+  // int is stored as the largest that fits.
+  unsigned long long stored =
+      std::min(head->frequency, static_cast<unsigned long long>(INT_MAX));
+  std::vector<unsigned char> frequency = int_to_bytes(static_cast<int>(stored));
 
   // Add the frequency vector to the tree vector
   tree.insert(tree.end(), frequency.begin(), frequency.end());
@@ -145,7 +149,7 @@ Node *tree_reconstructor(std::vector<unsigned char> treePacket) {
     std::vector<unsigned char> frequencyBytes{
         treePacket[i + 1], treePacket[i + 2], treePacket[i + 3],
         treePacket[i + 4]};
-    int frequency = byte_to_int(frequencyBytes);
+    unsigned int frequency = byte_to_int(frequencyBytes);
 
     // Create a new node using the value the node is representing
     // (treePacket[i]) and the frequency integer we just created Then add the
@@ -167,6 +171,85 @@ Node *tree_reconstructor(std::vector<unsigned char> treePacket) {
   return nodes[0];
 }
 
+/**
+ * Recursively converts a tree packet into a FlatTree.
+ *
+ * This function reads the packet entry at tracker, which works the same way as
+ * in link_nodes. A leaf becomes a FLAT_LEAF reference to its byte, while an
+ * internal node is given the next free index in the flat tree before its
+ * children are read, so the root always ends up as node 0.
+ *
+ * @param treePacket The vector of bytes representing the Huffman tree.
+ * @param tracker The index of the packet entry to convert, left at the last
+ * entry of its subtree.
+ * @param tree The flat tree being built.
+ * @return The child reference for the converted node.
+ * @throws std::invalid_argument If the packet ends early, has an unknown flag
+ * or has too many nodes.
+ */
+unsigned short flatten_packet(const std::vector<unsigned char> &treePacket,
+                              size_t &tracker, FlatTree &tree) {
+  if (tracker * 6 + 6 > treePacket.size()) {
+    throw std::invalid_argument("Tree packet ends in the middle of the tree.");
+  }
+
+  unsigned char value = treePacket[tracker * 6];
+  unsigned char flag = treePacket[tracker * 6 + 5];
+
+  if (flag == 'A') {
+    return FLAT_LEAF | value;
+  }
+
+  if (flag != 'B' && flag != 'C' && flag != 'D') {
+    throw std::invalid_argument("Invalid flag in tree packet.");
+  }
+
+  size_t index = tree.children.size() / 2;
+  if (index >= FLAT_LEAF) {
+    throw std::invalid_argument("Tree packet has too many nodes.");
+  }
+  tree.children.push_back(FLAT_EMPTY);
+  tree.children.push_back(FLAT_EMPTY);
+
+  // Both children are read in pre-order, left first, like link_nodes
+  if (flag == 'C' || flag == 'D') {
+    tracker++;
+    unsigned short left = flatten_packet(treePacket, tracker, tree);
+    tree.children[2 * index] = left;
+  }
+  if (flag == 'B' || flag == 'D') {
+    tracker++;
+    unsigned short right = flatten_packet(treePacket, tracker, tree);
+    tree.children[2 * index + 1] = right;
+  }
+
+  return static_cast<unsigned short>(index);
+}
+
+/**
+ * Builds a FlatTree directly from a tree packet.
+ *
+ * Unlike tree_reconstructor this allocates no nodes. The whole tree lives in
+ * one array of 16 bit child references, at most about 1 KB for a full tree of
+ * 256 bytes, which keeps a bit-by-bit walk within a few cache lines.
+ *
+ * @param treePacket The vector of bytes representing the Huffman tree.
+ * @return The flat tree.
+ * @throws std::invalid_argument If the packet is invalid or the tree has no
+ * internal nodes.
+ */
+FlatTree flat_tree_from_packet(const std::vector<unsigned char> &treePacket) {
+  if (treePacket.size() < 6 || treePacket.size() % 6 != 0) {
+    throw std::invalid_argument("Invalid packet size");
+  }
+
+  FlatTree tree;
+  size_t tracker = 0;
+  if (flatten_packet(treePacket, tracker, tree) & FLAT_LEAF) {
+    throw std::invalid_argument("Invalid Huffman tree, head has no children.");
+  }
+  return tree;
+}
 
 /**
  * Constructs a Huffman tree from a vector of nodes.
@@ -180,8 +263,8 @@ Node *tree_reconstructor(std::vector<unsigned char> treePacket) {
  * @param nodes The vector of nodes to be used to construct the Huffman tree.
  */
 void huffman_constructor(std::vector<Node *> &nodes) {
-  int lowestFreq1 = MAX_INT;
-  int lowestFreq2 = MAX_INT;
+  unsigned long long lowestFreq1 = MAX_FREQUENCY;
+  unsigned long long lowestFreq2 = MAX_FREQUENCY;
   std::vector<Node*>::size_type minIndex1 = -1; // Change type to size_type
   std::vector<Node*>::size_type minIndex2 = -1; // Change type to size_type
 
@@ -205,7 +288,7 @@ void huffman_constructor(std::vector<Node *> &nodes) {
   // Create a new node that combines the two frequencies of the child nodes,
   // assigning the smaller node as it's left child and the larger node as it's
   // right child
-  int newFreq = minNode1->frequency + minNode2->frequency;
+  unsigned long long newFreq = minNode1->frequency + minNode2->frequency;
   Node *newNode = new Node('Z', newFreq);
   newNode->left = minNode1;
   newNode->right = minNode2;
@@ -253,9 +336,13 @@ Node *create_huffman_tree(std::vector<Node *> &nodes) {
     temp->left = nodes[0];
     return temp;
   }
-  huffman_constructor(nodes);
 
-  int frequency = nodes[0]->frequency + nodes[1]->frequency;
+  // Two nodes are already the children of the root
+  if (nodes.size() > 2) {
+    huffman_constructor(nodes);
+  }
+
+  unsigned long long frequency = nodes[0]->frequency + nodes[1]->frequency;
   Node *head = new Node(0, frequency);
   if (nodes[0]->frequency < nodes[1]->frequency) {
     head->left = nodes[0];
@@ -296,6 +383,105 @@ void find_tree_path(Node *head, std::string path,
   find_tree_path(head->right, path + '1', table);
 }
 
+/**
+ * Recursively traverses a Huffman tree and records the code length of every
+ * leaf.
+ *
+ * This function works like find_tree_path but only tracks how deep each leaf
+ * is, which is all that is needed to assign canonical codes.
+ *
+ * @param head The current node of the Huffman tree.
+ * @param depth The depth of the current node, i.e. its code length.
+ * @param lengths The 256 entry vector where the code lengths will be stored.
+ * @throws std::runtime_error If a code is longer than MAX_CODE_LENGTH.
+ */
+void find_code_lengths(Node *head, int depth,
+                       std::vector<unsigned char> &lengths) {
+  if (head == nullptr) {
+    return;
+  }
+
+  if (head->left == nullptr && head->right == nullptr) {
+    if (depth > MAX_CODE_LENGTH) {
+      throw std::runtime_error("Huffman code is too long.");
+    }
+    lengths[head->value] = static_cast<unsigned char>(depth);
+    return;
+  }
+  find_code_lengths(head->left, depth + 1, lengths);
+  find_code_lengths(head->right, depth + 1, lengths);
+}
+
+/**
+ * Gets the code length of every byte value from a Huffman tree.
+ *
+ * @param huffmanHead The root of the Huffman tree.
+ * @return A vector of 256 code lengths indexed by byte value, where 0 means
+ * the byte does not appear in the tree.
+ * @throws std::invalid_argument If the tree is empty.
+ */
+std::vector<unsigned char> get_code_lengths(Node *huffmanHead) {
+  if (huffmanHead == nullptr) {
+    throw std::invalid_argument("Tree is empty.");
+  }
+
+  std::vector<unsigned char> lengths(256, 0);
+  find_code_lengths(huffmanHead, 0, lengths);
+  return lengths;
+}
+
+/**
+ * Assigns canonical Huffman codes from a list of code lengths.
+ *
+ * Canonical codes depend only on the length of each code. Bytes are ordered
+ * by code length and then by value, and each one is given the next binary
+ * number of its length, so the first code of every length follows directly
+ * from the number of shorter codes. This means only the lengths need to be
+ * stored to rebuild the exact same codes during decompression.
+ *
+ * @param lengths A vector of 256 code lengths indexed by byte value, 0 for
+ * bytes that have no code.
+ * @return A vector of 256 canonical codes as numbers, indexed by byte value.
+ * The code for a byte is the lowest lengths[byte] bits of its number.
+ * @throws std::invalid_argument If the lengths cannot form a prefix code.
+ */
+std::vector<unsigned long long>
+get_canonical_codes(const std::vector<unsigned char> &lengths) {
+  if (lengths.size() != 256) {
+    throw std::invalid_argument("Code length list must have 256 entries.");
+  }
+
+  for (int value = 0; value < 256; value++) {
+    if (lengths[value] > MAX_CODE_LENGTH) {
+      throw std::invalid_argument("Code length is too long.");
+    }
+  }
+
+  std::vector<unsigned long long> codes(256, 0);
+  unsigned long long code = 0;
+  int previousLength = 0;
+
+  for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+    for (int value = 0; value < 256; value++) {
+      if (lengths[value] != length) {
+        continue;
+      }
+
+      // Moving to a longer code appends zeros to the next free code
+      code <<= (length - previousLength);
+      previousLength = length;
+
+      if (code >> length) {
+        throw std::invalid_argument("Code lengths do not form a prefix code.");
+      }
+      codes[value] = code;
+      code++;
+    }
+  }
+
+  return codes;
+}
+
 /**
  * Creates a look-up table from a Huffman tree.
  *
@@ -304,11 +490,136 @@ void find_tree_path(Node *head, std::string path,
  * path to reach that node in the tree. The function uses the find_tree_path
  * helper function to traverse the tree and fill the table.
  *
+ * When canonical is set the codes keep the same lengths but are instead
+ * assigned with get_canonical_codes, so the table can be rebuilt from the code
+ * lengths alone.
+ *
  * @param huffmanHead The root of the Huffman tree.
+ * @param canonical Whether to assign canonical codes rather than tree paths.
  * @return A map representing the look-up table.
  */
-std::map<unsigned char, std::string> createTable(Node *huffmanHead) {
+std::map<unsigned char, std::string> createTable(Node *huffmanHead,
+                                                 bool canonical) {
   std::map<unsigned char, std::string> table;
-  find_tree_path(huffmanHead, "", table);
+  if (!canonical) {
+    find_tree_path(huffmanHead, "", table);
+    return table;
+  }
+
+  std::vector<unsigned char> lengths = get_code_lengths(huffmanHead);
+  std::vector<unsigned long long> codes = get_canonical_codes(lengths);
+
+  for (int value = 0; value < 256; value++) {
+    int length = lengths[value];
+    if (length == 0) {
+      continue;
+    }
+
+    // Write out the code most significant bit first
+    std::string path(length, '0');
+    for (int bit = 0; bit < length; bit++) {
+      if ((codes[value] >> (length - 1 - bit)) & 1) {
+        path[bit] = '1';
+      }
+    }
+    table[static_cast<unsigned char>(value)] = path;
+  }
   return table;
-}
\ No newline at end of file
+}
+
+/**
+ * Recursively fills an encode table with the paths to the leaves of a tree.
+ *
+ * This works like find_tree_path, but builds each code as a number, adding a
+ * 0 bit for every left branch and a 1 bit for every right branch.
+ *
+ * @param head The node currently being visited.
+ * @param code The bits of the path taken from the root to head.
+ * @param depth The number of bits in code.
+ * @param table The table being filled.
+ * @throws std::runtime_error If a code is longer than MAX_CODE_LENGTH.
+ */
+void find_codes(Node *head, unsigned long long code, int depth,
+                EncodeTable &table) {
+  if (head == nullptr) {
+    return;
+  }
+
+  if (head->left == nullptr && head->right == nullptr) {
+    if (depth > MAX_CODE_LENGTH) {
+      throw std::runtime_error("Huffman code is too long.");
+    }
+    table[head->value].code = code;
+    table[head->value].length = depth;
+    return;
+  }
+  find_codes(head->left, code << 1, depth + 1, table);
+  find_codes(head->right, (code << 1) | 1, depth + 1, table);
+}
+
+/**
+ * Creates the table the encoder looks codes up in from a Huffman tree.
+ *
+ * This holds the same codes as createTable, but as 256 (code, length) pairs
+ * indexed by byte value, so encoding a byte is one array lookup and the code
+ * can be written straight into a BitWriter.
+ *
+ * @param huffmanHead The root of the Huffman tree.
+ * @param canonical Whether to assign canonical codes rather than tree paths.
+ * @return The encode table.
+ * @throws std::invalid_argument If the tree is empty.
+ */
+EncodeTable create_encode_table(Node *huffmanHead, bool canonical) {
+  if (huffmanHead == nullptr) {
+    throw std::invalid_argument("Tree is empty.");
+  }
+
+  EncodeTable table;
+  if (!canonical) {
+    find_codes(huffmanHead, 0, 0, table);
+    return table;
+  }
+
+  std::vector<unsigned char> lengths = get_code_lengths(huffmanHead);
+  std::vector<unsigned long long> codes = get_canonical_codes(lengths);
+  for (int value = 0; value < 256; value++) {
+    table[value].code = codes[value];
+    table[value].length = lengths[value];
+  }
+  return table;
+}
+
+/**
+ * Creates the table the encoder looks up two bytes at a time in.
+ *
+ * Every entry joins the codes of two bytes, the first byte's code most
+ * significant, so encoding a pair is one lookup and one BitWriter write
+ * rather than two of each. The table has 65536 entries, so it is only worth
+ * building for data much larger than that. A pair holding a byte with no
+ * code is left as 0, which no real pair can be, so the encoder can reject it.
+ *
+ * @param table The encode table holding the code of every byte.
+ * @return The pair table, or an empty table if a code is longer than
+ * MAX_PAIR_CODE_LENGTH.
+ */
+PairTable create_pair_table(const EncodeTable &table) {
+  for (const EncodeEntry &entry : table) {
+    if (entry.length > MAX_PAIR_CODE_LENGTH) {
+      return PairTable();
+    }
+  }
+
+  PairTable pairs(256 * 256);
+  for (int first = 0; first < 256; first++) {
+    for (int second = 0; second < 256; second++) {
+      if (table[first].length == 0 || table[second].length == 0) {
+        continue;
+      }
+      unsigned long long length = table[first].length + table[second].length;
+      pairs[first << 8 | second] =
+          (table[first].code << table[second].length | table[second].code) |
+          length << 56;
+    }
+  }
+  return pairs;
+}
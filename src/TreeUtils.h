@@ -3,19 +3,73 @@
 
 #include "BitUtils.h"
 #include "Node.h"
+#include <algorithm>
+#include <array>
+#include <climits>
 #include <map>
 #include <stdexcept>
 #include <vector>
 
+// Longest code a Huffman code table may hold, short enough that a whole code
+// always fits in a 64 bit window next to a partially used byte
+const int MAX_CODE_LENGTH = 56;
+static_assert(MAX_CODE_LENGTH <= BitWriter::MAX_WRITE,
+              "Every code must fit in one BitWriter write.");
+
+// Child references in a FlatTree. A reference with FLAT_LEAF set is a leaf
+// holding the byte in its low 8 bits, FLAT_EMPTY is a missing child and any
+// other value is the index of an internal node.
+const unsigned short FLAT_LEAF = 0x8000;
+const unsigned short FLAT_EMPTY = 0xFFFF;
+
+// A Huffman tree stored as one contiguous array. Internal node i has its left
+// and right child references at children[2 * i] and children[2 * i + 1], and
+// the root is internal node 0.
+struct FlatTree {
+  std::vector<unsigned short> children;
+};
+
+// The code of one byte, the low length bits of code most significant first
+struct EncodeEntry {
+  unsigned long long code = 0;
+  int length = 0;
+};
+
+// The codes of all 256 byte values in one contiguous array, bytes that do not
+// appear in the tree have a length of 0
+typedef std::array<EncodeEntry, 256> EncodeTable;
+
+// Longest code a PairTable is built for, short enough that the codes of two
+// bytes always fit in one BitWriter write
+const int MAX_PAIR_CODE_LENGTH = MAX_CODE_LENGTH / 2;
+
+// The joined codes of every pair of bytes, indexed by the first byte times 256
+// plus the second. An entry holds the code in its low 56 bits and its length
+// in the top 8 bits.
+typedef std::vector<unsigned long long> PairTable;
+
 void pre_order_packing(Node *head, std::vector<unsigned char> &tree);
 std::vector<unsigned char> get_tree_packet(Node *head);
 void link_nodes(Node *current, std::vector<Node *> &nodes,
                 std::vector<unsigned char> &flags, int &tracker);
 Node *tree_reconstructor(std::vector<unsigned char> treePacket);
+unsigned short flatten_packet(const std::vector<unsigned char> &treePacket,
+                              size_t &tracker, FlatTree &tree);
+FlatTree flat_tree_from_packet(const std::vector<unsigned char> &treePacket);
 void huffman_constructor(std::vector<Node *> &nodes);
 Node *create_huffman_tree(std::vector<Node *> &nodes);
 void find_tree_path(Node *head, std::string path,
                     std::map<unsigned char, std::string> &table);
-std::map<unsigned char, std::string> createTable(Node *huffmanHead);
+void find_code_lengths(Node *head, int depth,
+                       std::vector<unsigned char> &lengths);
+std::vector<unsigned char> get_code_lengths(Node *huffmanHead);
+std::vector<unsigned long long>
+get_canonical_codes(const std::vector<unsigned char> &lengths);
+std::map<unsigned char, std::string> createTable(Node *huffmanHead,
+                                                 bool canonical = false);
+void find_codes(Node *head, unsigned long long code, int depth,
+                EncodeTable &table);
+EncodeTable create_encode_table(Node *huffmanHead, bool canonical = false);
+PairTable create_pair_table(const EncodeTable &table);
 
 #endif
\ No newline at end of file
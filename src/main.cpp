@@ -1,14 +1,76 @@
 #include "CompUtils.h"
+#include <cstdlib>
 
 int main(int argc, char *argv[]) {
 
-  if (argc < 2) {
+  CompressOptions compressOptions;
+  DecompressOptions decompressOptions;
+  bool estimate = false;
+  std::string file;
+
+  // Options start with a dash, anything else is the file to work on
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--canonical") {
+      compressOptions.canonical = true;
+    } else if (arg.rfind("--streams=", 0) == 0) {
+      compressOptions.streams = std::atoi(arg.c_str() + 10);
+    } else if (arg.rfind("--block-size=", 0) == 0) {
+      compressOptions.blockSize = std::strtoull(arg.c_str() + 13, nullptr, 10);
+    } else if (arg == "--single-pass") {
+      compressOptions.singlePass = true;
+    } else if (arg == "--index") {
+      compressOptions.indexInterval = DEFAULT_INDEX_INTERVAL;
+    } else if (arg.rfind("--index=", 0) == 0) {
+      compressOptions.indexInterval = std::strtoull(arg.c_str() + 8, nullptr, 10);
+    } else if (arg == "--estimate") {
+      estimate = true;
+    } else if (arg == "--sample") {
+      compressOptions.samplePercent = DEFAULT_SAMPLE_PERCENT;
+    } else if (arg.rfind("--sample=", 0) == 0) {
+      compressOptions.samplePercent = std::strtod(arg.c_str() + 9, nullptr);
+    } else if (arg == "--range" && i + 1 < argc) {
+      // The range is given as start:length
+      char *end;
+      decompressOptions.range = true;
+      decompressOptions.rangeStart = std::strtoull(argv[++i], &end, 10);
+      if (*end != ':') {
+        std::cout << "Range must be given as start:length." << std::endl;
+        return 1;
+      }
+      decompressOptions.rangeLength = std::strtoull(end + 1, nullptr, 10);
+    } else if (arg == "-T" && i + 1 < argc) {
+      compressOptions.threads = std::atoi(argv[++i]);
+      decompressOptions.threads = compressOptions.threads;
+    } else if (arg.rfind("--threads=", 0) == 0) {
+      compressOptions.threads = std::atoi(arg.c_str() + 10);
+      decompressOptions.threads = compressOptions.threads;
+    } else if (arg == "--multi-symbol") {
+      decompressOptions.multiSymbol = true;
+    } else if (arg.rfind("--buffer-size=", 0) == 0) {
+      decompressOptions.bufferSize = std::strtoull(arg.c_str() + 14, nullptr, 10);
+    } else if (arg == "--no-simd") {
+      compressOptions.simd = false;
+      decompressOptions.simd = false;
+    } else if (arg.rfind("--cache-dir=", 0) == 0) {
+      compressOptions.cacheDir = arg.substr(12);
+    } else if (arg == "--populate") {
+      compressOptions.populate = true;
+    } else if (arg == "--writev") {
+      decompressOptions.writev = true;
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      std::cout << "Unknown option: " << arg << std::endl;
+      return 1;
+    } else {
+      file = arg;
+    }
+  }
+
+  if (file.empty()) {
     std::cout << "Please provide the file name as an argument." << std::endl;
     return 1;
   }
 
-  std::string file = argv[1];
-
   // Check if the file has an extension
   size_t periodPos = file.rfind('.');
   if (periodPos == std::string::npos) {
@@ -20,13 +82,34 @@ int main(int argc, char *argv[]) {
   std::string extension = file.substr(periodPos + 1);
   if (extension == "hcmp") {
     try {
-      decompress_data(file);
+      decompress_data(file, decompressOptions);
     } catch (const std::exception &e) {
       std::cout << "Decompression failed: " << e.what() << std::endl;
     }
+  } else if (estimate) {
+    try {
+      SizeEstimate sizes = estimate_compressed_size(file, compressOptions);
+      std::cout << "Original size: " << sizes.originalSize << " bytes\n"
+                << "Compressed size: " << (sizes.exact ? "" : "at most ")
+                << sizes.compressedSize << " bytes\n"
+                << "Ratio: " << sizes.ratio << std::endl;
+      if (compressOptions.samplePercent > 0) {
+        // What building the tree from a sample costs over counting every byte
+        double cost = sizes.fullCompressedSize > 0
+                          ? 100.0 * sizes.compressedSize /
+                                    sizes.fullCompressedSize -
+                                100
+                          : 0;
+        std::cout << "Size with every byte counted: "
+                  << sizes.fullCompressedSize << " bytes\n"
+                  << "Sampling cost: " << cost << "%" << std::endl;
+      }
+    } catch (const std::exception &e) {
+      std::cout << "Estimate failed: " << e.what() << std::endl;
+    }
   } else {
     try {
-      compress_data(file);
+      compress_data(file, compressOptions);
     } catch (const std::exception &e) {
       std::cout << "Compression failed: " << e.what() << std::endl;
     }